@@ -80,6 +80,11 @@ lama::ThreadPool::~ThreadPool()
 
 void lama::ThreadPool::enqueue(std::function<void()>&& function)
 {
+    if (workers.empty()){
+        function();
+        return;
+    }
+
     ++tasks_to_complete;
     queue->tasks.enqueue(std::move(function));
     if (sleep_count > 0){
@@ -32,7 +32,7 @@ struct ThreadPool {
     // Tasks as submited to the queue by the user an fetched
     // by the workers. All concurrency problems are handled
     // by the queue.
-    TaskQueue* queue;
+    TaskQueue* queue{nullptr};
 
     // Any working threads will exit, after finishing its task,
     // if stop is true.
@@ -56,7 +56,8 @@ struct ThreadPool {
     void init(size_t size = 0);
 
     // Enqueue (or post) a function to be executed by one
-    // of the workers.
+    // of the workers. If the pool was not initialized (no
+    // workers) the function is executed in the calling thread.
     void enqueue(std::function<void()>&& function);
 
     bool dequeue_task();
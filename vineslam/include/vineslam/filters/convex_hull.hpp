@@ -128,7 +128,6 @@ struct ConvexHull
   static void getIntersectionPoints(const Point& l1p1, const Point& l1p2, const SemiPlane& poly,
                                     std::vector<Point>& isct)
   {
-    std::vector<Point> i_pts;
     for (size_t i = 0; i < poly.extremas_.size(); i++)
     {
       size_t next = (i + 1 == poly.extremas_.size()) ? 0 : i + 1;
@@ -165,12 +164,7 @@ struct ConvexHull
     for (int i = 0, next = 1; i < static_cast<int>(S1.extremas_.size());
          i++, next = (i + 1 == static_cast<int>(S1.extremas_.size())) ? 0 : i + 1)
     {
-      std::vector<Point> l_isct;
-      getIntersectionPoints(S1.extremas_[i], S1.extremas_[next], S2, l_isct);
-      if (!l_isct.empty())
-      {
-        isct.insert(isct.end(), l_isct.begin(), l_isct.end());
-      }
+      getIntersectionPoints(S1.extremas_[i], S1.extremas_[next], S2, isct);
     }
 
     if (!isct.empty())
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <eigen3/Eigen/Dense>
+
+#include <vineslam/feature/three_dimensional.hpp>
+#include <vineslam/math/Point.hpp>
+
+namespace vineslam
+{
+// First and second order moments of a set of points, accumulated point by point
+struct PlaneMoments
+{
+  void add(const Point& pt)
+  {
+    double x = pt.x_;
+    double y = pt.y_;
+    double z = pt.z_;
+
+    n_ += 1;
+    x_ += x;
+    y_ += y;
+    z_ += z;
+    xx_ += x * x;
+    xy_ += x * y;
+    xz_ += x * z;
+    yy_ += y * y;
+    yz_ += y * z;
+    zz_ += z * z;
+  }
+
+  PlaneMoments& operator+=(const PlaneMoments& other)
+  {
+    n_ += other.n_;
+    x_ += other.x_;
+    y_ += other.y_;
+    z_ += other.z_;
+    xx_ += other.xx_;
+    xy_ += other.xy_;
+    xz_ += other.xz_;
+    yy_ += other.yy_;
+    yz_ += other.yz_;
+    zz_ += other.zz_;
+
+    return *this;
+  }
+
+  // Least squares plane of the points, in closed form
+  // - its normal is the eigenvector of the smallest eigenvalue of the 3x3 covariance, and it contains the centroid
+  // - the normal is unitary, so |a * x + b * y + c * z + d| is the distance of a point to the plane
+  bool fit(float& a, float& b, float& c, float& d) const
+  {
+    if (n_ < 3)
+    {
+      return false;
+    }
+
+    Eigen::Vector3d mean(x_ / n_, y_ / n_, z_ / n_);
+    Eigen::Matrix3d covariance;
+    covariance << xx_ / n_, xy_ / n_, xz_ / n_, xy_ / n_, yy_ / n_, yz_ / n_, xz_ / n_, yz_ / n_, zz_ / n_;
+    covariance -= mean * mean.transpose();
+
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigen_solver;
+    eigen_solver.computeDirect(covariance);
+    Eigen::Vector3d normal = eigen_solver.eigenvectors().col(0);
+
+    double offset = -normal.dot(mean);
+    if (!std::isfinite(offset))
+    {
+      return false;
+    }
+
+    a = static_cast<float>(normal.x());
+    b = static_cast<float>(normal.y());
+    c = static_cast<float>(normal.z());
+    d = static_cast<float>(offset);
+
+    return true;
+  }
+
+  double n_{};
+  double x_{}, y_{}, z_{};
+  double xx_{}, xy_{}, xz_{}, yy_{}, yz_{}, zz_{};
+};
+
+struct PlaneFit
+{
+  // Refines a plane by refitting it max_iters times to the points that lie within a band around it, whose width is
+  // halved in every iteration down to 2 * dist_threshold
+  // - returns the number of points within dist_threshold of the refined plane
+  static int refine(const std::vector<Point>& in_pts, float& a, float& b, float& c, float& d, const int& max_iters,
+                    const float& dist_threshold)
+  {
+    float band = dist_threshold * static_cast<float>(1 << max_iters);
+    for (int i = 0; i < max_iters; i++)
+    {
+      PlaneMoments inliers;
+      for (const auto& pt : in_pts)
+      {
+        if (std::fabs(a * pt.x_ + b * pt.y_ + c * pt.z_ + d) < band)
+        {
+          inliers.add(pt);
+        }
+      }
+
+      // Keep the previous plane if the band became too narrow
+      if (!inliers.fit(a, b, c, d))
+      {
+        break;
+      }
+      band /= 2;
+    }
+
+    int n_inliers = 0;
+    for (const auto& pt : in_pts)
+    {
+      n_inliers += (std::fabs(a * pt.x_ + b * pt.y_ + c * pt.z_ + d) < dist_threshold) ? 1 : 0;
+    }
+
+    return n_inliers;
+  }
+
+  // Fits a plane to a set of points, given a few hypotheses as the moments of subsets of them
+  // - the least squares plane of each hypothesis is refined, and the one with more inliers is kept
+  // - the output plane holds the points within dist_threshold of it, and their least squares plane
+  static bool process(const std::vector<Point>& in_pts, const std::vector<PlaneMoments>& hypotheses, Plane& out_plane,
+                      int max_iters = 4, float dist_threshold = 0.01)
+  {
+    return process(in_pts, hypotheses.data(), hypotheses.data() + hypotheses.size(), out_plane, max_iters,
+                   dist_threshold);
+  }
+
+  static bool process(const std::vector<Point>& in_pts, const PlaneMoments& hypothesis, Plane& out_plane,
+                      int max_iters = 4, float dist_threshold = 0.01)
+  {
+    return process(in_pts, &hypothesis, &hypothesis + 1, out_plane, max_iters, dist_threshold);
+  }
+
+  static bool process(const std::vector<Point>& in_pts, const PlaneMoments* hypotheses_begin,
+                      const PlaneMoments* hypotheses_end, Plane& out_plane, int max_iters, float dist_threshold)
+  {
+    int max_inliers = 0;
+    float best_a = 0., best_b = 0., best_c = 0., best_d = 0.;
+    for (const PlaneMoments* hypothesis = hypotheses_begin; hypothesis != hypotheses_end; hypothesis++)
+    {
+      float a, b, c, d;
+      if (!hypothesis->fit(a, b, c, d))
+      {
+        continue;
+      }
+
+      int n_inliers = refine(in_pts, a, b, c, d, max_iters, dist_threshold);
+      if (n_inliers > max_inliers)
+      {
+        max_inliers = n_inliers;
+        best_a = a;
+        best_b = b;
+        best_c = c;
+        best_d = d;
+      }
+    }
+
+    if (max_inliers == 0)
+    {
+      return false;
+    }
+
+    // Gather the inliers
+    PlaneMoments inliers;
+    out_plane.points_.clear();
+    for (const auto& pt : in_pts)
+    {
+      if (std::fabs(best_a * pt.x_ + best_b * pt.y_ + best_c * pt.z_ + best_d) < dist_threshold)
+      {
+        out_plane.points_.push_back(pt);
+        inliers.add(pt);
+      }
+    }
+    inliers.fit(best_a, best_b, best_c, best_d);
+
+    out_plane.a_ = best_a;
+    out_plane.b_ = best_b;
+    out_plane.c_ = best_c;
+    out_plane.d_ = best_d;
+
+    return true;
+  }
+};
+
+}  // namespace vineslam
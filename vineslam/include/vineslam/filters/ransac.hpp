@@ -2,10 +2,13 @@
 
 #include <iostream>
 #include <vector>
+#include <cmath>
+#include <algorithm>
 
 #include <vineslam/feature/three_dimensional.hpp>
 #include <vineslam/math/Point.hpp>
 #include <vineslam/math/Const.hpp>
+#include <vineslam/math/Rng.hpp>
 #include <vineslam/extern/thread_pool.h>
 
 namespace vineslam
@@ -17,22 +20,26 @@ struct Ransac
     // -------------------------------------------------------------------------------
     // ----- Use PCA to refine th normal vector using all the inliers
     // -------------------------------------------------------------------------------
-    // - 1st: assemble data matrix
-    Eigen::MatrixXf data_mat;
-    data_mat.conservativeResize(points.size(), 3);
-    for (size_t i = 0; i < points.size(); i++)
+    // - 1st: calculate the mean of the points
+    Eigen::Vector3f mean = Eigen::Vector3f::Zero();
+    for (const auto& pt : points)
+    {
+      mean += Eigen::Vector3f(pt.x_, pt.y_, pt.z_);
+    }
+    if (!points.empty())
+    {
+      mean /= static_cast<float>(points.size());
+    }
+    // - 2nd: accumulate the covariance matrix of the centered points, without assembling a data matrix
+    Eigen::Matrix3f covariance_mat = Eigen::Matrix3f::Zero();
+    for (const auto& pt : points)
     {
-      Point pt = points[i];
-      Eigen::Matrix<float, 1, 3> pt_mat(pt.x_, pt.y_, pt.z_);
-      data_mat.block<1, 3>(i, 0) = pt_mat;
+      Eigen::Vector3f centered_pt = Eigen::Vector3f(pt.x_, pt.y_, pt.z_) - mean;
+      covariance_mat += centered_pt * centered_pt.transpose();
     }
-    // - 2nd: calculate mean and subtract it to the data matrix
-    Eigen::MatrixXf centered_mat = data_mat.rowwise() - data_mat.colwise().mean();
-    // - 3rd: calculate covariance matrix
-    Eigen::MatrixXf covariance_mat = (centered_mat.adjoint() * centered_mat);
-    // - 4rd: calculate eigenvectors and eigenvalues of the covariance matrix
-    Eigen::SelfAdjointEigenSolver<Eigen::MatrixXf> eigen_solver(covariance_mat);
-    const Eigen::MatrixXf& eigen_vectors = eigen_solver.eigenvectors();
+    // - 3rd: calculate eigenvectors and eigenvalues of the covariance matrix
+    Eigen::SelfAdjointEigenSolver<Eigen::Matrix3f> eigen_solver(covariance_mat);
+    const Eigen::Matrix3f& eigen_vectors = eigen_solver.eigenvectors();
 
     Vec normal = Vec(eigen_vectors.col(0)[0], eigen_vectors.col(0)[1], eigen_vectors.col(0)[2]);
 
@@ -41,57 +48,45 @@ struct Ransac
     // -------------------------------------------------------------------------------
     normal.normalize();
 
-    Point avg_pt(0, 0, 0);
-    for (const auto& pt : points)
-    {
-      avg_pt.x_ += pt.x_;
-      avg_pt.y_ += pt.y_;
-      avg_pt.z_ += pt.z_;
-    }
-    avg_pt.x_ = (points.empty()) ? 0 : avg_pt.x_ / static_cast<float>(points.size());
-    avg_pt.y_ = (points.empty()) ? 0 : avg_pt.y_ / static_cast<float>(points.size());
-    avg_pt.z_ = (points.empty()) ? 0 : avg_pt.z_ / static_cast<float>(points.size());
-
     a = normal.x_;
     b = normal.y_;
     c = normal.z_;
-    d = -(normal.x_ * avg_pt.x_ + normal.y_ * avg_pt.y_ + normal.z_ * avg_pt.z_);
+    d = -(normal.x_ * mean.x() + normal.y_ * mean.y() + normal.z_ * mean.z());
   }
 
   static bool process(const std::vector<Point>& in_pts, Plane& out_plane, int max_iters = 20,
                       float dist_threshold = 0.08, bool filter_distant_pts = false)
   {
-    std::vector<Point> pts;
+    // - the filtered points are kept in a per thread workspace, reused across calls
+    thread_local std::vector<Point> filtered_pts;
+    const std::vector<Point>* pts_ptr = &in_pts;
     if (filter_distant_pts)
     {
+      filtered_pts.clear();
       for (const auto& pt : in_pts)
       {
         if (pt.norm3D() < 5)
         {
-          pts.push_back(pt);
+          filtered_pts.push_back(pt);
         }
       }
+      pts_ptr = &filtered_pts;
     }
-    else
-    {
-      pts = in_pts;
-    }
+    const std::vector<Point>& pts = *pts_ptr;
 
     if (pts.empty())
     {
       return false;
     }
 
-    int max_idx = static_cast<int>(pts.size()) - 1;
-    int min_idx = 0;
+    Rng& rng = Rng::threadLocal();
+    auto n_pts = static_cast<uint32_t>(pts.size());
     int max_tries = 1000;
     int c_max_inliers = 0;
 
+    float best_a = 0., best_b = 0., best_c = 0., best_d = 0.;
     for (int i = 0; i < max_iters; i++)
     {
-      // Declare private point cloud to store current solution
-      std::vector<Point> l_pcl;
-
       // Reset number of inliers in each iteration
       int num_inliers = 0;
 
@@ -102,9 +97,9 @@ struct Ransac
       int idx1, idx2, idx3;
       while (!found_valid_pts)
       {
-        idx1 = std::rand() % (max_idx - min_idx + 1) + min_idx;
-        idx2 = std::rand() % (max_idx - min_idx + 1) + min_idx;
-        idx3 = std::rand() % (max_idx - min_idx + 1) + min_idx;
+        idx1 = static_cast<int>(rng.uniformInt(n_pts));
+        idx2 = static_cast<int>(rng.uniformInt(n_pts));
+        idx3 = static_cast<int>(rng.uniformInt(n_pts));
 
         if (idx1 != idx2 && idx1 != idx3 && idx2 != idx3)
           found_valid_pts = true;
@@ -136,15 +131,15 @@ struct Ransac
       float l_c = abc.z_;
       float l_d = -(l_a * pt1.x_ + l_b * pt1.y_ + l_c * pt1.z_);
 
+      // Compute the distance each point to the plane - from
+      // https://www.geeksforgeeks.org/distance-between-a-point-and-a-plane-in-3-d/
+      // - only the inliers are counted here, they are gathered once for the best model
+      float norm = std::sqrt(l_a * l_a + l_b * l_b + l_c * l_c);
       for (const auto& l_pt : pts)
       {
-        // Compute the distance each point to the plane - from
-        // https://www.geeksforgeeks.org/distance-between-a-point-and-a-plane-in-3-d/
-        auto norm = std::sqrt(l_a * l_a + l_b * l_b + l_c * l_c);
         if (std::fabs(l_a * l_pt.x_ + l_b * l_pt.y_ + l_c * l_pt.z_ + l_d) / norm < dist_threshold)
         {
           num_inliers++;
-          l_pcl.push_back(l_pt);
         }
       }
 
@@ -152,15 +147,32 @@ struct Ransac
       {
         c_max_inliers = num_inliers;
 
-        out_plane.points_.clear();
-        out_plane.points_ = l_pcl;
-        out_plane.a_ = l_a;
-        out_plane.b_ = l_b;
-        out_plane.c_ = l_c;
-        out_plane.d_ = l_d;
+        best_a = l_a;
+        best_b = l_b;
+        best_c = l_c;
+        best_d = l_d;
       }
     }
 
+    // Gather the inliers of the best model
+    if (c_max_inliers > 0)
+    {
+      float norm = std::sqrt(best_a * best_a + best_b * best_b + best_c * best_c);
+      out_plane.points_.clear();
+      out_plane.points_.reserve(c_max_inliers);
+      for (const auto& l_pt : pts)
+      {
+        if (std::fabs(best_a * l_pt.x_ + best_b * l_pt.y_ + best_c * l_pt.z_ + best_d) / norm < dist_threshold)
+        {
+          out_plane.points_.push_back(l_pt);
+        }
+      }
+      out_plane.a_ = best_a;
+      out_plane.b_ = best_b;
+      out_plane.c_ = best_c;
+      out_plane.d_ = best_d;
+    }
+
     // PCA-based normal refinement using all the inliers
     float l_a, l_b, l_c, l_d;
     estimateNormal(out_plane.points_, l_a, l_b, l_c, l_d);
@@ -182,6 +194,142 @@ struct Ransac
 
     return success;
   }
+
+  // Adaptive RANSAC plane fit - the same model as process(), with a number of iterations set by the inlier ratio
+  // - the iterations stop once a sample of three inliers has been drawn with the given confidence, given the
+  //   inlier ratio of the best model so far, with max_iters as an upper bound
+  // - the points are scored in blocks of SIMD-friendly coordinate arrays, and a hypothesis is dropped as soon as it
+  //   can no longer beat the best one even if all its remaining points are inliers
+  static bool processAdaptive(const std::vector<Point>& in_pts, Plane& out_plane, int max_iters = 300,
+                              float dist_threshold = 0.08, bool filter_distant_pts = false, float confidence = 0.99)
+  {
+    // - the coordinates are kept in a per thread workspace, reused across calls
+    thread_local std::vector<float> pts_x, pts_y, pts_z;
+    thread_local std::vector<int> pts_idx;
+    pts_x.clear();
+    pts_y.clear();
+    pts_z.clear();
+    pts_idx.clear();
+    for (size_t i = 0; i < in_pts.size(); i++)
+    {
+      const Point& pt = in_pts[i];
+      if (!filter_distant_pts || pt.norm3D() < 5)
+      {
+        pts_x.push_back(pt.x_);
+        pts_y.push_back(pt.y_);
+        pts_z.push_back(pt.z_);
+        pts_idx.push_back(static_cast<int>(i));
+      }
+    }
+
+    const auto n_pts = static_cast<int>(pts_idx.size());
+    if (n_pts < 3)
+    {
+      return false;
+    }
+
+    Eigen::Map<const Eigen::ArrayXf> xs(pts_x.data(), n_pts);
+    Eigen::Map<const Eigen::ArrayXf> ys(pts_y.data(), n_pts);
+    Eigen::Map<const Eigen::ArrayXf> zs(pts_z.data(), n_pts);
+
+    // Number of inliers of a normalized plane, or -1 if it is dropped for not beating min_inliers
+    const int block_size = 256;
+    auto countInliers = [&](const float& a, const float& b, const float& c, const float& d, const int& min_inliers) {
+      int num_inliers = 0;
+      for (int begin = 0; begin < n_pts; begin += block_size)
+      {
+        int n = std::min(block_size, n_pts - begin);
+        num_inliers += static_cast<int>(
+            ((a * xs.segment(begin, n) + b * ys.segment(begin, n) + c * zs.segment(begin, n) + d).abs() <
+             dist_threshold)
+                .count());
+        if (num_inliers + (n_pts - begin - n) <= min_inliers)
+        {
+          return -1;
+        }
+      }
+      return num_inliers;
+    };
+
+    Rng& rng = Rng::threadLocal();
+    const auto n_candidates = static_cast<uint32_t>(n_pts);
+    const float log_outlier_prob = std::log(1.f - confidence);
+    int n_iters = max_iters;
+    int c_max_inliers = 0;
+
+    float best_a = 0., best_b = 0., best_c = 0., best_d = 0.;
+    for (int i = 0; i < n_iters; i++)
+    {
+      // Randomly select three points that cannot be cohincident
+      int idx1 = static_cast<int>(rng.uniformInt(n_candidates));
+      int idx2, idx3;
+      do
+      {
+        idx2 = static_cast<int>(rng.uniformInt(n_candidates));
+      } while (idx2 == idx1);
+      do
+      {
+        idx3 = static_cast<int>(rng.uniformInt(n_candidates));
+      } while (idx3 == idx1 || idx3 == idx2);
+
+      // Extract the normalized plane hessian coefficients - collinear samples give no plane
+      Eigen::Vector3f pt1(xs[idx1], ys[idx1], zs[idx1]);
+      Eigen::Vector3f abc = (Eigen::Vector3f(xs[idx2], ys[idx2], zs[idx2]) - pt1)
+                                .cross(Eigen::Vector3f(xs[idx3], ys[idx3], zs[idx3]) - pt1);
+      float norm = abc.norm();
+      if (!(norm > 0))
+      {
+        continue;
+      }
+      abc /= norm;
+      float l_d = -abc.dot(pt1);
+
+      int num_inliers = countInliers(abc.x(), abc.y(), abc.z(), l_d, c_max_inliers);
+      if (num_inliers > c_max_inliers)
+      {
+        c_max_inliers = num_inliers;
+
+        best_a = abc.x();
+        best_b = abc.y();
+        best_c = abc.z();
+        best_d = l_d;
+
+        // Adaptive stopping criterion, from the inlier ratio of the new best model
+        float inlier_ratio = static_cast<float>(c_max_inliers) / static_cast<float>(n_pts);
+        float sample_prob = inlier_ratio * inlier_ratio * inlier_ratio;
+        if (sample_prob >= 1.)
+        {
+          break;
+        }
+        float needed_iters = log_outlier_prob / std::log(1.f - sample_prob);
+        if (needed_iters < static_cast<float>(n_iters))
+        {
+          n_iters = static_cast<int>(std::ceil(needed_iters));
+        }
+      }
+    }
+
+    if (c_max_inliers == 0)
+    {
+      return false;
+    }
+
+    // Gather the inliers of the best model
+    out_plane.points_.clear();
+    out_plane.points_.reserve(c_max_inliers);
+    for (int i = 0; i < n_pts; i++)
+    {
+      if (std::fabs(best_a * xs[i] + best_b * ys[i] + best_c * zs[i] + best_d) < dist_threshold)
+      {
+        out_plane.points_.push_back(in_pts[pts_idx[i]]);
+      }
+    }
+
+    // PCA-based normal refinement using all the inliers
+    estimateNormal(out_plane.points_, out_plane.a_, out_plane.b_, out_plane.c_, out_plane.d_);
+
+    return true;
+  }
 };
 
 }  // namespace vineslam
\ No newline at end of file
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include <vineslam/math/Point.hpp>
+
+namespace vineslam
+{
+// Voxel grid downsampling of a point cloud
+// - the voxels are found with an open addressing hash table on their integer coordinates, with linear probing, that
+//   is kept between calls so that it is only allocated when a larger cloud comes in
+// - each voxel keeps either its first point, or the centroid of its points
+// - the output keeps the order of the first point of each voxel
+class VoxelGrid
+{
+public:
+  VoxelGrid() = default;
+  VoxelGrid(const float& leaf_size, const bool& centroid) : leaf_size_(leaf_size), centroid_(centroid)
+  {
+  }
+
+  bool enabled() const
+  {
+    return leaf_size_ > 0;
+  }
+
+  // Downsamples in_pts into out_pts
+  // - out_idx receives the index, in in_pts, of the first point of each voxel, that is the one kept if the voxels
+  //   are not replaced by their centroid
+  void process(const std::vector<Point>& in_pts, std::vector<Point>& out_pts, std::vector<int>& out_idx)
+  {
+    out_pts.clear();
+    out_idx.clear();
+
+    // Size the table to at least twice the number of points, so that the probe sequences stay short
+    size_t capacity = 16;
+    while (capacity < 2 * in_pts.size())
+      capacity <<= 1;
+    if (keys_.size() < capacity)
+    {
+      keys_.resize(capacity);
+      slots_.resize(capacity);
+    }
+    std::fill(slots_.begin(), slots_.begin() + capacity, -1);
+    const size_t mask = capacity - 1;
+
+    const float inv_leaf_size = 1.f / leaf_size_;
+    n_pts_.clear();
+    for (size_t i = 0; i < in_pts.size(); i++)
+    {
+      const Point& pt = in_pts[i];
+      uint64_t key = voxelKey(pt, inv_leaf_size);
+
+      size_t slot = hash(key) & mask;
+      while (slots_[slot] != -1 && keys_[slot] != key)
+        slot = (slot + 1) & mask;
+
+      if (slots_[slot] == -1)
+      {
+        keys_[slot] = key;
+        slots_[slot] = static_cast<int>(out_pts.size());
+        out_pts.push_back(pt);
+        out_idx.push_back(static_cast<int>(i));
+        if (centroid_)
+          n_pts_.push_back(1);
+      }
+      else if (centroid_)
+      {
+        out_pts[slots_[slot]] = out_pts[slots_[slot]] + pt;
+        n_pts_[slots_[slot]]++;
+      }
+    }
+
+    if (centroid_)
+    {
+      for (size_t i = 0; i < out_pts.size(); i++)
+        out_pts[i] = out_pts[i] / static_cast<float>(n_pts_[i]);
+    }
+  }
+
+private:
+  // Packs the integer coordinates of the voxel of a point in 21 bits each
+  static uint64_t voxelKey(const Point& pt, const float& inv_leaf_size)
+  {
+    auto coord = [](const float& v) {
+      auto c = static_cast<int64_t>(std::floor(v));
+      return static_cast<uint64_t>(std::min<int64_t>(std::max<int64_t>(c + (1 << 20), 0), (1 << 21) - 1));
+    };
+
+    return coord(pt.x_ * inv_leaf_size) | (coord(pt.y_ * inv_leaf_size) << 21) |
+           (coord(pt.z_ * inv_leaf_size) << 42);
+  }
+
+  // Fibonacci hashing - the high bits of the product are folded into the low ones, that are the ones masked
+  static size_t hash(const uint64_t& key)
+  {
+    uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+    return static_cast<size_t>(h ^ (h >> 32));
+  }
+
+  float leaf_size_{};
+  bool centroid_{};
+
+  // Hash table, and the number of points of each voxel when computing centroids
+  std::vector<uint64_t> keys_;
+  std::vector<int> slots_;
+  std::vector<int> n_pts_;
+};
+
+}  // namespace vineslam
@@ -6,6 +6,7 @@
 #include "../feature/semantic.hpp"
 #include "../feature/three_dimensional.hpp"
 #include "../mapping/occupancy_map.hpp"
+#include "../mapping/elevation_map.hpp"
 #include "../matcher/icp.hpp"
 #include "../localization/pf.hpp"
 #include "../math/Point.hpp"
@@ -15,6 +16,7 @@
 // std, eigen
 #include <iostream>
 #include <thread>
+#include <mutex>
 #include <map>
 
 namespace vineslam
@@ -46,7 +48,15 @@ public:
   // - wheel_odom_inc: odometry incremental pose
   // - obsv:           current multi-layer mapping observation
   // - grid_map:       occupancy grid map that encodes the multi-layer map information
-  void process(const Pose& odom, const Observation& obsv, OccupancyMap* grid_map);
+  // - time_budget:    time budget (ms) of the call - the filter update is cut short when it expires (0 = no budget)
+  void process(const Pose& odom, const Observation& obsv, OccupancyMap* grid_map, const float& time_budget = 0.);
+  // Asynchronous updates - weight the particles with a single measurement, at its own rate
+  // - the weights are accumulated until the next LiDAR update, and only resampled before it if the effective sample
+  //   size falls below pf.async_resampling_neff of the particles, and the motion model ran since the last resampling
+  //   (resampling again without it would only collapse the particle set)
+  // - they can be called from the sensors callbacks, concurrently with process()
+  void processGPS(const Pose& gps_pose);
+  void processIMU(const Pose& imu_pose);
 
   // Export the final pose resultant from the localization procedure
   Pose getPose() const;
@@ -55,20 +65,30 @@ public:
 
   // Setters
   void changeGPSFlag(const bool& val);
+  // - elevation map used to constrain the particles height, roll and pitch in the reduced state
+  void setElevationMap(ElevationMap* elevation_map);
+  // - static grid map scored by the worker processes (pf.worker_processes) - it must not change afterwards
+  // - the workers are forked, so it must be called after init, before the localizer is shared with other threads
+  void spawnWorkers(OccupancyMap* grid_map);
 
   // Particle filter object
   PF* pf_{};
 private:
+  // Resample the particles and compute the average pose after an asynchronous update, if their accumulated weights
+  // have degenerated
+  void resampleIfDegenerate();
+
   // Average particles pose
   Pose average_pose_;
   Pose last_update_pose_;
   Pose p_odom_;
 
-  // Particles before resampling
-  std::vector<Particle> m_particles_;
-
   // Flags
   bool init_flag_;
+  bool moved_since_resampling_{};
+
+  // Serializes the access to the particle filter between the synchronous and asynchronous updates
+  mutable std::mutex mutex_;
 
   // Input parameters
   Parameters params_;
@@ -5,21 +5,28 @@
 #include <vineslam/feature/semantic.hpp>
 #include <vineslam/feature/three_dimensional.hpp>
 #include <vineslam/mapping/occupancy_map.hpp>
+#include <vineslam/mapping/elevation_map.hpp>
 #include <vineslam/math/Point.hpp>
 #include <vineslam/math/Pose.hpp>
 #include <vineslam/math/Const.hpp>
 #include <vineslam/math/Stat.hpp>
+#include <vineslam/math/Rng.hpp>
+#include <vineslam/utils/Threads.hpp>
 #include <vineslam/filters/convex_hull.hpp>
 #include <vineslam/filters/ransac.hpp>
 #include <vineslam/utils/Timer.hpp>
 #include <vineslam/extern/thread_pool.h>
 
 // Include std members
+#include <semaphore.h>
+#include <sys/types.h>
+#include <atomic>
 #include <cstdlib>
 #include <limits>
 #include <chrono>
 #include <iostream>
 #include <map>
+#include <numeric>
 #include <cmath>
 
 namespace vineslam
@@ -58,14 +65,34 @@ public:
   // Class constructor
   // - initializes the total set of particles
   PF(const Parameters& params, const Pose& initial_pose);
+  // Class destructor - stops the scoring worker processes
+  ~PF();
+
+  // Spread the particles around an initial pose, with the same weight - the scoring workers are kept
+  void spreadParticles(const Pose& initial_pose);
 
   // Apply odometry motion model to all particles
   void motionModel(const Pose& odom_inc);
   // Update particles weights using the multi-layer map
+  // - if a deadline is set, the particles are scored by decreasing prior weight until it expires, and the ones
+  //   left unscored get a null weight
+  // - in coarse-to-fine mode (pf.fine_particles), all the particles are first scored with a subsampled feature set,
+  //   and only the best ones are then fully scored - the others keep their coarse score, scaled down to the range
+  //   of the fine weights
   void update(const std::vector<SemanticFeature>& landmarks, const std::vector<Corner>& corners,
               const std::vector<Planar>& planars, const std::vector<SemiPlane>& planes, const SemiPlane& ground_plane,
-               const Pose& gps_pose, const Pose& imu_pose,
-              OccupancyMap* grid_map);
+              const Pose& gps_pose, const Pose& imu_pose, OccupancyMap* grid_map,
+              const std::chrono::steady_clock::time_point& deadline = std::chrono::steady_clock::time_point::max());
+  // Weight the particles using a single cheap layer, as soon as its measurement arrives
+  // - the likelihood of the layer is multiplied into the weights accumulated since the last resampling, that are
+  //   folded into the next update()
+  // - returns false if the layer is disabled or gives no information, leaving the weights untouched
+  bool updateGPS(const Pose& gps_pose);
+  bool updateIMU(const Pose& imu_pose);
+  // Effective sample size of the weights accumulated by updateGPS() and updateIMU()
+  float effectiveSampleSize() const;
+  // Set the particles weights to the accumulated weights, before resampling them outside of update()
+  void takeAccumulatedWeights();
   // Update 'beam model of range finders'
   void updateModel(const float& z_k, const float& z_k_asterisc, const float& z_dist, const float& sigma_hit,
                    const float& sigma_short, float& w);
@@ -73,6 +100,22 @@ public:
   void normalizeWeights();
   // Resample particles
   void resample();
+  // Normalize and resample the particles in a single parallel pass (systematic resampling)
+  // - the offspring of each particle are counted through a prefix sum over the weights
+  // - surviving particles keep their slot, so only the duplicated ones are copied
+  void systematicResample();
+
+  // Set the elevation map used to constrain the particles in the reduced (3-DoF) state
+  void setElevationMap(ElevationMap* elevation_map);
+
+  // Launch pf.worker_processes processes to score the corner and planar layers
+  // - the workers are forked, so they share the grid map pages with this process (copy-on-write) instead of
+  //   duplicating it - the map must not change afterwards
+  // - the particle poses, features and weights are exchanged through a shared memory segment
+  // - a forked worker only keeps the calling thread, so it only runs the scoring and never takes a lock - it should
+  //   still be called as early as possible, before the caller starts its own threads
+  // - returns false if no workers were launched, in which case the layers are scored in-process
+  bool spawnWorkers(OccupancyMap* grid_map);
 
   // Particle weight sum
   float w_sum_{};
@@ -107,6 +150,30 @@ private:
   // Samples a zero-mean gaussian distribution with a given standard deviation
   float sampleGaussian(const float& sigma, const unsigned long int& S = 0);
 
+  // Runs fn(block, begin, end) over all the blocks of particles, in parallel if possible
+  // - the enqueued tasks only hold a reference and the block index, so that they fit in the std::function
+  //   small object buffer and enqueuing them does not allocate
+  template <typename Function>
+  void forEachBlock(const Function& fn)
+  {
+    auto run = [this, &fn](const uint32_t& t) {
+      fn(t, (particles_size_ * t) / n_blocks_, (particles_size_ * (t + 1)) / n_blocks_);
+    };
+
+    for (uint32_t t = 0; t < n_blocks_; t++)
+      thread_pool_->enqueue([&run, t]() { run(t); });
+
+    thread_pool_->wait();
+  }
+
+  // Motion model kernel - innovates the particles in [begin, end) drawing the noise from a given stream
+  void motionModel(const Tf& odom_inc_tf, const float& d_trans, Rng& rng, const uint32_t& begin,
+                   const uint32_t& end);
+
+  // Set the height, roll and pitch of a pose from the elevation map under the robot footprint
+  // - returns false if the footprint was not observed in the map, leaving the pose untouched
+  bool constrainToTerrain(Pose& pose) const;
+
   // Update functions
   // - High level semantic features layer
   void highLevel(const std::vector<SemanticFeature>& landmarks, OccupancyMap* grid_map, std::vector<float>& ws);
@@ -116,13 +183,91 @@ private:
   void mediumLevelPlanars(const std::vector<Planar>& planars, OccupancyMap* grid_map, std::vector<float>& ws);
   // - Medium ground plane layer
   void mediumLevelPlanes(const std::vector<SemiPlane>& planes, OccupancyMap* grid_map, std::vector<float>& ws);
+  // - Per particle scores of the LiDAR layers - stride > 1 scores a subsampled set of features
+  float cornerWeight(const Particle& particle, const std::vector<Corner>& corners, OccupancyMap* grid_map,
+                     const size_t& stride = 1) const;
+  float planarWeight(const Particle& particle, const std::vector<Planar>& planars, OccupancyMap* grid_map,
+                     const size_t& stride = 1) const;
+  float planeWeight(const Particle& particle, const std::vector<SemiPlane>& planes, OccupancyMap* grid_map) const;
   // - GPS
   void gps(const Pose& gps_pose, std::vector<float>& ws);
   // - IMU
   void imu(const Pose& imu_pose, std::vector<float>& ws);
+  // Multiply the likelihood of a single layer into the accumulated weights
+  bool accumulateWeights(const std::vector<float>& ws);
+
+  // Memory shared with the scoring worker processes
+  struct ScoringSegment
+  {
+    void* base{};
+    size_t size{};
+    sem_t* done{};   // posted by a worker when its batch is scored
+    sem_t* jobs{};   // one per worker, posted when a new batch is available
+    bool* stop{};    // set before posting the jobs to shut the workers down
+    uint32_t* n_corners{};
+    uint32_t* n_planars{};
+    Tf* tfs{};
+    Corner* corners{};
+    Planar* planars{};
+    float* corner_weights{};
+    float* planar_weights{};
+  };
+  // Score the corner and planar layers in the worker processes
+  // - returns false if there are no workers, or if they could not score this update
+  bool scoreInWorkers(const std::vector<Corner>& corners, const std::vector<Planar>& planars,
+                      std::vector<float>& corner_ws, std::vector<float>& planar_ws);
+  // Main loop of a worker process - never returns
+  void workerLoop(const uint32_t& w, OccupancyMap* grid_map);
+  // Shut the worker processes down and release the shared segment
+  void stopWorkers(const bool& force = false);
 
   // Number of particles
   uint32_t particles_size_;
+  // Number of worker threads
+  uint32_t n_threads_;
+  // Number of blocks in which the particles are split to be processed in parallel
+  uint32_t n_blocks_;
+
+  // Random number generators
+  Rng rng_;
+  std::vector<Rng> rng_streams_;
+
+  // Motion model scratch memory
+  std::vector<float> motion_buf_;
+
+  // Update scratch memory
+  std::vector<float> semantic_weights_;
+  std::vector<float> corner_weights_;
+  std::vector<float> planar_weights_;
+  std::vector<float> planes_weights_;
+  std::vector<float> ground_weights_;
+  std::vector<float> surf_weights_;
+  std::vector<float> gps_weights_;
+  std::vector<float> imu_weights_;
+  // - weights accumulated by the asynchronous updates since the last resampling, scaled so that their maximum is 1
+  std::vector<float> async_weights_;
+  std::vector<uint8_t> scored_;
+  std::vector<uint32_t> order_;
+  std::vector<float> coarse_corners_;
+  std::vector<float> coarse_planars_;
+  std::vector<float> coarse_score_;
+  std::vector<SemiPlane> ground_planes_;
+
+  // Resampling scratch memory
+  std::vector<uint32_t> resample_idx_;
+  std::vector<uint32_t> offspring_;
+  std::vector<uint32_t> free_slots_;
+  std::vector<uint32_t> extra_src_;
+  std::vector<float> block_sum_;
+  std::vector<uint32_t> block_free_;
+  std::vector<uint32_t> block_extra_;
+
+  // Elevation map used in the reduced state
+  ElevationMap* elevation_map_{};
+
+  // Scoring worker processes
+  std::vector<pid_t> workers_;
+  ScoringSegment segment_;
 
   // Parameters structure
   Parameters params_;
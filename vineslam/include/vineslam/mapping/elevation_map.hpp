@@ -77,6 +77,10 @@ public:
   // Update the cell altimetry using the (x,y) location
   bool update(const float& z, const float& i, const float& j);
 
+  // Get the cell altimetry at the (x,y) location
+  // - returns false if the location is out of the map or was never observed
+  bool getElevation(const float& x, const float& y, float& z) const;
+
   // Get elevation color
   static void color(float z, float& r, float& g, float& b);
 
@@ -4,28 +4,58 @@
 #include <iostream>
 #include <unordered_map>
 #include <deque>
+#include <mutex>
+#include <numeric>
 #include <eigen3/Eigen/Dense>
 
 #include <vineslam/params.hpp>
 #include <vineslam/feature/three_dimensional.hpp>
 #include <vineslam/mapping/occupancy_map.hpp>
 #include <vineslam/mapping/elevation_map.hpp>
+#include <vineslam/mapping/lidar_model.hpp>
 #include <vineslam/math/Point.hpp>
 #include <vineslam/math/Pose.hpp>
 #include <vineslam/math/Tf.hpp>
 #include <vineslam/math/Const.hpp>
 #include <vineslam/filters/ransac.hpp>
+#include <vineslam/filters/plane_fit.hpp>
 #include <vineslam/filters/convex_hull.hpp>
+#include <vineslam/filters/voxel_grid.hpp>
 #include <vineslam/utils/Timer.hpp>
+#include <vineslam/utils/Threads.hpp>
+#include <vineslam/extern/thread_pool.h>
 
 namespace vineslam
 {
+// LiDAR scan, as given by the sensor driver
+struct LidarScan
+{
+  std::vector<Point> pts_;
+  // Ring and column of each point - empty if the driver does not provide them
+  std::vector<uint16_t> rings_;
+  std::vector<uint16_t> columns_;
+  // Number of columns of the driver range image - 0 if the scan is not a range image
+  uint32_t n_columns_{};
+  // Acquisition time, in seconds
+  double time_stamp_{};
+};
+
 class LidarMapper
 {
 public:
   // Class constructor - receives and saves the system
   // parameters
   explicit LidarMapper();
+  virtual ~LidarMapper() = default;
+
+  // Builds the mapper of a sensor, given its name - velodyne or livox - returns nullptr if the sensor is not known
+  static LidarMapper* create(const std::string& sensor, const Parameters& params);
+
+  // Builds the local map of a scan, on the base_link referential frame
+  virtual void localMap(const LidarScan& scan, std::vector<Corner>& out_corners, std::vector<Planar>& out_planars,
+                        std::vector<SemiPlane>& out_planes, SemiPlane& out_groundplane) = 0;
+  virtual void localMap(const LidarScan& scan, std::vector<Corner>& out_corners, std::vector<Planar>& out_planars,
+                        SemiPlane& out_groundplane) = 0;
 
   void registerMaps(const Pose& robot_pose, const std::vector<Corner>& corners, const std::vector<Planar>& planars,
                     const std::vector<SemiPlane>& planes, const SemiPlane& ground, OccupancyMap& grid_map,
@@ -53,7 +83,20 @@ public:
   float lidar_height_;
 
   // Previous robot pose
+  // - the local map of a scan may be built while the previous one is registered, so it is read through
+  //   prevRobotPose(), and written under its mutex
   Pose prev_robot_pose_;
+  Pose prevRobotPose() const
+  {
+    std::lock_guard<std::mutex> lock(prev_robot_pose_mutex_);
+    return prev_robot_pose_;
+  }
+  // Sets the previous robot pose of a mapper that does not register the maps itself
+  void setPrevRobotPose(const Pose& robot_pose)
+  {
+    std::lock_guard<std::mutex> lock(prev_robot_pose_mutex_);
+    prev_robot_pose_ = robot_pose;
+  }
 
   // Robot dimensions vars
   float robot_dim_x_;
@@ -68,6 +111,19 @@ public:
   // Transformation parameters
   float laser2base_x_{}, laser2base_y_{}, laser2base_z_{}, laser2base_roll_{}, laser2base_pitch_{}, laser2base_yaw_{};
 
+protected:
+  // Downsamples an input scan with the voxel grid, if it is enabled - returns either the downsampled scan, or the
+  // input one
+  // - the index of each kept point in the input scan is stored in voxel_idx_
+  const std::vector<Point>& voxelFilter(const std::vector<Point>& pcl);
+
+  mutable std::mutex prev_robot_pose_mutex_;
+
+  // Voxel grid prefilter of the input scans
+  VoxelGrid voxel_grid_;
+  std::vector<Point> voxel_pcl_;
+  std::vector<int> voxel_idx_;
+
 private:
   // -------------------------------------------------------------------------------
   // ---- 3D pointcloud feature map
@@ -88,7 +144,7 @@ private:
 
 struct SegPCL
 {
-  std::vector<bool> is_ground;
+  std::vector<uint8_t> is_ground;  // bytes, so that different rings can be written from different threads
   std::vector<int> start_col_idx;
   std::vector<int> end_col_idx;
   std::vector<int> col_idx;
@@ -113,38 +169,107 @@ class VelodyneMapper : public LidarMapper
 {
 public:
   VelodyneMapper(const Parameters& params);
+  // Class destructor - stops the worker threads
+  ~VelodyneMapper();
 
   // -------------------------------------------------------------------------------
   // ---- 3D pointcloud feature map
   // -------------------------------------------------------------------------------
+  // Builds local map given a scan, organized or not
+  void localMap(const LidarScan& scan, std::vector<Corner>& out_corners, std::vector<Planar>& out_planars,
+                std::vector<SemiPlane>& out_planes, SemiPlane& out_groundplane) override;
+  void localMap(const LidarScan& scan, std::vector<Corner>& out_corners, std::vector<Planar>& out_planars,
+                SemiPlane& out_groundplane) override;
   // Builds local map given the current 3D point cloud - for velodyne
   void localMap(const std::vector<Point>& pcl, std::vector<Corner>& out_corners, std::vector<Planar>& out_planars,
                 std::vector<SemiPlane>& out_planes, SemiPlane& out_groundplane);
   void localMap(const std::vector<Point>& pcl, std::vector<Corner>& out_corners, std::vector<Planar>& out_planars,
                 SemiPlane& out_groundplane);
+  // Builds local map given an organized 3D point cloud, with the ring and column of each point given by the driver
+  // - the points are stored straight into their range image pixel, skipping the angular projection
+  // - columns may be empty, in which case they are computed from the points azimuth
+  // - rings may be empty, in which case the cloud is handled as an unorganized one
+  void localMap(const std::vector<Point>& pcl, const std::vector<uint16_t>& rings,
+                const std::vector<uint16_t>& columns, std::vector<Corner>& out_corners,
+                std::vector<Planar>& out_planars, std::vector<SemiPlane>& out_planes, SemiPlane& out_groundplane);
+  void localMap(const std::vector<Point>& pcl, const std::vector<uint16_t>& rings,
+                const std::vector<uint16_t>& columns, std::vector<Corner>& out_corners,
+                std::vector<Planar>& out_planars, SemiPlane& out_groundplane);
 
 private:
+  using Coord2D = Eigen::Vector2i;
+
+  // Method to size the per scan workspace, once, from the sensor model
+  void allocate();
   // Method to reset all the global variables and members
   void reset();
+  // Methods that resize the range image to the number of columns of the driver, if it differs from the sensor
+  // model one - either given by the driver, or grown to the largest column of an organized scan
+  void fitColumns(const uint32_t& n_columns);
+  void fitColumns(const std::vector<Point>& pcl, const std::vector<uint16_t>& rings,
+                  const std::vector<uint16_t>& columns);
 
-  // Method that extracts the ground plane of an input point cloud
-  void groundRemoval(const std::vector<Point>& in_pts, Plane& out_pcl);
-  void flatGroundRemoval(const std::vector<Point>& in_pts, Plane& out_pcl);
+  // Downsamples an input scan with the voxel grid, along with its rings and columns
+  const std::vector<Point>& voxelFilter(const std::vector<Point>& pcl, const std::vector<uint16_t>& rings,
+                                        const std::vector<uint16_t>& columns);
+
+  // Stores the points of a cloud in their range image pixel
+  void projectToRangeImage(const std::vector<Point>& pcl, const std::vector<uint16_t>& rings,
+                           const std::vector<uint16_t>& columns, std::vector<Point>& out_pcl);
+
+  // Method that marks the ground points of the range image in a single pass, collecting at the same time the
+  // candidates to the ground plane and the moments of the slabs of heights where it most likely is
+  void groundSegmentation(const std::vector<Point>& in_pts, Plane& out_pcl, std::vector<PlaneMoments>& out_hypotheses);
 
   // Cloud generic plane segmentation
   void cloudSegmentation(const std::vector<Point>& in_pts, std::vector<PlanePoint>& cloud_seg);
 
   // Label a segment of a 3D point cloud
   void labelComponents(const int& row, const int& col, int& label);
+  // Label all the segments of the range image at once, with a union-find over its pixels
+  // - the image is split in strips of columns that are joined in parallel, and then merged at their borders
+  // - gives the same labels as running labelComponents from every unlabeled pixel
+  void labelComponentsUnionFind();
+  // Union-find operations - the root of a segment is always its first pixel in row-major order
+  int findRoot(int idx);
+  void join(const int& a, const int& b);
+  // Check if two neighbour pixels belong to the same segment, given the link constant of their direction
+  bool linked(const float& d1, const float& d2, const float& link) const
+  {
+    return std::min(d1, d2) * link > std::max(d1, d2) * sin_planes_th_;
+  }
 
   // Extract a couple of semiplanes
   void extractHighLevelPlanes(const std::vector<Point>& in_plane_pts, const SemiPlane& ground_plane,
                               std::vector<SemiPlane>& out_planes);
+  // Split the points above the ground by the mean of their y component, and fit each side with RANSAC
+  void ransacSidePlanes(const std::vector<Point>& in_pts, const SemiPlane& ground_plane, const Tf& tf,
+                        std::vector<Plane>& planes);
+  // Split the segmented points by the mean of their y component, keeping the vertical segments whole, and fit each
+  // side starting from the least squares plane of its vertical segments
+  void segmentSidePlanes(const SemiPlane& ground_plane, const Tf& tf, std::vector<Plane>& planes);
   bool checkPlaneConsistency(const SemiPlane& plane, const SemiPlane& ground_plane);
 
   // 3D feature extraction from a point cloud
   void extractFeatures(const std::vector<PlanePoint>& in_plane_pts, std::vector<Corner>& out_corners,
                        std::vector<Planar>& out_planars);
+  // Feature extraction in the sub-regions of a single ring
+  void extractRingFeatures(const std::vector<PlanePoint>& in_plane_pts, const int& ring,
+                           std::vector<smoothness_t>& candidates, std::vector<Corner>& out_corners,
+                           std::vector<Planar>& out_planars);
+
+  // Runs fn(block, begin, end) over n items split in one block per thread, in parallel if possible
+  template <typename Function>
+  void forEachBlock(const int& n, const Function& fn)
+  {
+    auto n_blocks = static_cast<int>(n_threads_);
+    auto run = [&fn, &n, &n_blocks](const int& t) { fn(t, (n * t) / n_blocks, (n * (t + 1)) / n_blocks); };
+
+    for (int t = 0; t < n_blocks; t++)
+      thread_pool_->enqueue([&run, t]() { run(t); });
+
+    thread_pool_->wait();
+  }
 
   // Cloud segmentation matrices
   Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic> range_mat_;
@@ -153,9 +278,81 @@ private:
   // Cloud segmentation & feature extraction structure
   SegPCL seg_pcl_;
 
+  // Sensor geometry
+  LidarModel model_;
+
+  // Per scan scratch memory - sized once in the constructor, and reused in every scan
+  std::vector<Point> range_image_pcl_;
+  std::vector<uint16_t> voxel_rings_;
+  std::vector<uint16_t> voxel_columns_;
+  std::vector<PlanePoint> cloud_seg_;
+  Plane ground_candidates_;
+  std::vector<Coord2D> segment_queue_;
+  std::vector<uint8_t> line_count_flag_;
+  std::vector<Point> non_ground_;
+  Plane side_planes_[2];
+  std::vector<PlanePoint> segment_pts_;
+  std::vector<float> segment_pts_y_;
+  std::vector<PlaneMoments> segment_moments_;
+  std::vector<int8_t> segment_side_;
+  std::vector<float> smoothness_;
+  std::vector<double> range_sum_;
+  std::vector<int> neighbor_picked_;
+  std::vector<uint8_t> occlusion_;
+  std::vector<int> planar_label_;
+  std::vector<int> corner_label_;
+  std::vector<int> ring_offset_;
+  // - one per thread
+  std::vector<std::vector<smoothness_t>> block_candidates_;
+  std::vector<std::vector<Corner>> block_corners_;
+  std::vector<std::vector<Planar>> block_planars_;
+  std::vector<std::vector<Point>> block_ground_;
+  std::vector<std::vector<PlaneMoments>> block_moments_;
+  std::vector<PlaneMoments> ground_bins_;
+  std::vector<PlaneMoments> ground_slabs_;
+  std::vector<PlaneMoments> ground_hypotheses_;
+
+  // Occlusion flags of a point - it hides the 6 points up to itself, the next 6 points, or is hidden itself
+  static const uint8_t OCCLUDES_BACKWARD = 0x01;
+  static const uint8_t OCCLUDES_FORWARD = 0x02;
+  static const uint8_t OCCLUDED = 0x04;
+
+  // Number of ground plane hypotheses
+  static const int GROUND_HYPOTHESES = 3;
+
+  // Union-find segmentation
+  // - two neighbours at ranges d1 and d2, seen at an angle alpha, belong to the same segment if
+  //   atan2(dmin * sin(alpha), dmax - dmin * cos(alpha)) > planes_th, which is the same as
+  //   dmin * sin(alpha + planes_th) > dmax * sin(planes_th) - so the link constants sin(alpha + planes_th) are
+  //   computed once for the horizontal neighbours and for each pair of consecutive rings
+  struct SegmentStats
+  {
+    int size;
+    int rows;
+    int last_row;
+    int seed_row_pixels;
+    int label;
+  };
+  bool union_find_{};
+  int n_segments_{};
+  std::vector<int> parent_;
+  std::vector<SegmentStats> segment_stats_;
+  float sin_planes_th_{};
+  float horizontal_link_{};
+  std::vector<float> vertical_links_;
+
+  // Plane extraction from the segments
+  bool segment_planes_{};
+
+  // Thread pool
+  lama::ThreadPool* thread_pool_{};
+  uint32_t n_threads_{};
+
   // 3D cloud feature parameters
   float planes_th_{};
   float ground_th_{};
+  float tan2_ground_th_{};
+  float ground_bin_size_{ 0.1 };
   float edge_threshold_{};
   float planar_threshold_{};
   int picked_num_{};
@@ -164,9 +361,7 @@ private:
   int ground_scan_idx_{};
   int segment_valid_point_num_{};
   int segment_valid_line_num_{};
-  float vertical_angle_bottom_{};
   float ang_res_x_{};
-  float ang_res_y_{};
 };
 
 // ----------------------------------------------
@@ -226,27 +421,6 @@ struct Pt_infos
   Eigen::Matrix<float, 2, 1> pt_2d_img_;  // project to X==1 plane
 };
 
-struct Pt_compare
-{
-  inline bool operator()(const Point& a, const Point& b)
-  {
-    return ((a.x_ < b.x_) || (a.x_ == b.x_ && a.y_ < b.y_) || ((a.x_ == b.x_) && (a.y_ == b.y_) && (a.z_ < b.z_)));
-  }
-
-  bool operator()(const Point& a, const Point& b) const
-  {
-    return (a.x_ == b.x_) && (a.y_ == b.y_) && (a.z_ == b.z_);
-  }
-};
-
-struct Pt_hasher
-{
-  std::size_t operator()(const Point& k) const
-  {
-    return ((std::hash<float>()(k.x_) ^ (std::hash<float>()(k.y_) << 1)) >> 1) ^ (std::hash<float>()(k.z_) << 1);
-  }
-};
-
 class LivoxMapper : public LidarMapper
 {
 public:
@@ -255,17 +429,21 @@ public:
   // -------------------------------------------------------------------------------
   // ---- 3D pointcloud feature map
   // -------------------------------------------------------------------------------
-  // Builds local map given the current 3D point cloud - for velodyne
+  // Builds local map given a scan, using its time stamp
+  void localMap(const LidarScan& scan, std::vector<Corner>& out_corners, std::vector<Planar>& out_planars,
+                std::vector<SemiPlane>& out_planes, SemiPlane& out_groundplane) override;
+  void localMap(const LidarScan& scan, std::vector<Corner>& out_corners, std::vector<Planar>& out_planars,
+                SemiPlane& out_groundplane) override;
+  // Builds local map given the current 3D point cloud - for livox
   void localMap(const std::vector<Point>& pcl, const double& time_stamp, std::vector<Corner>& out_corners,
                 std::vector<Planar>& out_planars, std::vector<SemiPlane>& out_planes, SemiPlane& out_groundplane);
   void localMap(const std::vector<Point>& pcl, const double& time_stamp, std::vector<Corner>& out_corners,
                 std::vector<Planar>& out_planars, SemiPlane& out_groundplane);
 
 private:
-  Pt_infos* findPtInfo(const Point& pt);
   void getFeatures(std::vector<Point>& pc_corners, std::vector<Point>& pc_surface, std::vector<Point>& pc_full_res,
                    float minimum_blur = 0.0, float maximum_blur = 0.3);
-  void setIntensity(Point& pt, const E_intensity_type& i_type = e_I_motion_blur);
+  void setIntensity(Point& pt, const Pt_infos& pt_info, const E_intensity_type& i_type = e_I_motion_blur);
   std::vector<std::vector<Point>> extractLaserFeatures(const std::vector<Point>& laser_cloud_in, double time_stamp);
   void addMaskOfPoint(Pt_infos* pt_infos, const E_point_type& pt_type, int neighbor_count = 0);
   void evalPoint(Pt_infos* pt_info);
@@ -274,12 +452,10 @@ private:
                       const std::vector<float>& scan_id_index, std::vector<std::vector<Point>>& laser_cloud_scans);
   void computeFeatures();
 
-  template <typename T>
-  T vector_angle(const Eigen::Matrix<T, 3, 1>& vec_a, const Eigen::Matrix<T, 3, 1>& vec_b,
-                 int if_force_sharp_angle = 0);
-
-  // Method that extracts the ground plane of an input point cloud
-  void flatGroundRemoval(const std::vector<Point>& in_pts, Plane& out_pcl);
+  // Projects the points onto a grid of azimuth and elevation bins that spans the field of view of the sensor
+  void fovBinProjection(const std::vector<Point>& in_pts);
+  // Method that extracts the ground plane from the bins of the last projected point cloud
+  void flatGroundRemoval(Plane& out_pcl);
   // Extract a couple of semiplanes
   void extractHighLevelPlanes(const std::vector<Point>& in_plane_pts, const SemiPlane& ground_plane,
                               std::vector<SemiPlane>& out_planes);
@@ -301,23 +477,30 @@ private:
   float thr_corner_curvature_;
   float thr_surface_curvature_;
   float minimum_view_angle_;
+  // Per point info, indexed by the position of the point in the input scan
   std::vector<Pt_infos> pts_info_vec_;
   std::vector<Point> raw_pts_vec_;
-
-  std::unordered_map<Point, Pt_infos*, Pt_hasher, Pt_compare> map_pt_idx_;  // using hash_map
-  std::unordered_map<Point, Pt_infos*, Pt_hasher, Pt_compare>::iterator map_pt_idx_it_;
+  // Coordinates and curvature of the points along the scan line, kept between scans to reuse their memory
+  std::vector<float> pts_x_, pts_y_, pts_z_;
+  std::vector<float> curvature_vec_;
 
   float livox_min_allow_dis_;
   float livox_min_sigma_;
 
-  float lidar_height_;
-  int horizontal_scans_{};
-  int vertical_scans_{};
-  int ground_scan_idx_{};
   float ground_th_{};
-  float vertical_angle_bottom_;
-  float ang_res_x_;
-  float ang_res_y_;
+
+  // Field of view bins - the points of each bin are stored contiguously in bin_pts_, from bin_offsets_[bin] to
+  // bin_offsets_[bin + 1], and bin_closest_ holds the slot of the closest one, or -1 if the bin is empty
+  float fov_half_angle_;
+  float fov_bin_res_;
+  int fov_bins_;
+  int ground_bin_gap_;
+  std::vector<int> pt_bins_;
+  std::vector<int> bin_offsets_;
+  std::vector<int> bin_fill_;
+  std::vector<int> bin_closest_;
+  std::vector<Point> bin_pts_;
+  std::vector<Point> bin_closest_pts_;
 };
 
 }  // namespace vineslam
\ No newline at end of file
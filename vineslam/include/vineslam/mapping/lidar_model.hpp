@@ -0,0 +1,201 @@
+#pragma once
+
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <vineslam/math/Const.hpp>
+
+namespace vineslam
+{
+// Geometry of a spinning multi-beam LiDAR, used to project its point clouds into a range image
+// - rings are sorted by increasing elevation, row i of the range image being ring i
+// - the row and column of a point are read from lookup tables built once, so that the projection costs a
+//   division and a few integer operations per index instead of an atan2 and a sqrt
+struct LidarModel
+{
+  // Builds the model of a known sensor: vlp16, vlp32c, hdl64, os1_64 or os1_128
+  // - unknown names fall back to the VLP-16
+  explicit LidarModel(const std::string& name = "vlp16")
+  {
+    name_ = name;
+    if (name == "vlp32c")
+    {
+      elevations_ = { -25.,    -15.639, -11.31, -8.843, -7.254, -6.148, -5.333, -4.667, -4.,     -3.667, -3.333,
+                      -3.,     -2.667,  -2.333, -2.,    -1.667, -1.333, -1.,    -0.667, -0.333, 0.,     0.333,
+                      0.667,   1.,      1.333,  1.667,  2.333,  3.333,  4.667,  7.,     10.333, 15. };
+      horizontal_scans_ = 1800;
+    }
+    else if (name == "hdl64")
+    {
+      // - upper block from 2 to -8.33 deg in 1/3 deg steps, lower block from -8.83 to -24.33 deg in 1/2 deg steps
+      for (int i = 0; i < 32; i++)
+        elevations_.push_back(static_cast<float>(-24.33 + 0.5 * i));
+      for (int i = 31; i >= 0; i--)
+        elevations_.push_back(static_cast<float>(2. - i / 3.));
+      horizontal_scans_ = 2083;
+    }
+    else if (name == "os1_64")
+    {
+      uniformRings(64, -16.6, 16.6);
+      horizontal_scans_ = 1024;
+      rings_top_down_ = true;
+    }
+    else if (name == "os1_128")
+    {
+      uniformRings(128, -22.5, 22.5);
+      horizontal_scans_ = 1024;
+      rings_top_down_ = true;
+    }
+    else
+    {
+      if (name != "vlp16")
+      {
+        std::cout << "LidarModel::LidarModel() --- unknown model " << name << ", using vlp16.\n";
+        name_ = "vlp16";
+      }
+      uniformRings(16, -15., 15.);
+      horizontal_scans_ = 1800;
+    }
+
+    for (auto& elevation : elevations_)
+      elevation *= DEGREE_TO_RAD;
+
+    // The ground is searched between the rings that point below the horizon
+    vertical_scans_ = static_cast<int>(elevations_.size());
+    ground_scan_idx_ = -1;
+    for (const auto& elevation : elevations_)
+      ground_scan_idx_ += (elevation < 0.) ? 1 : 0;
+    ang_res_x_ = M_2PI / static_cast<float>(horizontal_scans_);
+
+    buildTables();
+  }
+
+  // Range image row of a point at a given range, or -1 if it is outside the vertical field of view
+  int row(const float& z, const float& range) const
+  {
+    float bin = (z / range - row_lut_min_) * row_lut_scale_;
+    if (!(bin >= 0.) || bin >= static_cast<float>(ROW_LUT_SIZE))
+    {
+      return -1;
+    }
+
+    return row_lut_[static_cast<int>(bin)];
+  }
+
+  // Range image row of a ring numbered by the driver, or -1 if there is no such ring
+  int ringToRow(const int& ring) const
+  {
+    if (ring >= vertical_scans_)
+    {
+      return -1;
+    }
+
+    return rings_top_down_ ? vertical_scans_ - 1 - ring : ring;
+  }
+
+  // Range image column of a point - column horizontal_scans_ / 2 looks forward, and columns grow counterclockwise
+  int column(const float& x, const float& y) const
+  {
+    float ax = std::fabs(x);
+    float ay = std::fabs(y);
+
+    // Azimuth in columns, reduced to the first octant and then unfolded
+    float a;
+    if (ax >= ay)
+    {
+      a = (ax > 0.) ? atanColumns(ay / ax) : 0.;
+    }
+    else
+    {
+      a = quarter_turn_ - atanColumns(ax / ay);
+    }
+    if (x < 0.)
+    {
+      a = 2 * quarter_turn_ - a;
+    }
+    if (y < 0.)
+    {
+      a = -a;
+    }
+
+    auto column = static_cast<int>(a + static_cast<float>(horizontal_scans_ / 2) + 0.5);
+    return (column >= horizontal_scans_) ? column - horizontal_scans_ : column;
+  }
+
+  // Angle between two rings
+  float ringGap(const int& row_a, const int& row_b) const
+  {
+    return std::fabs(elevations_[row_b] - elevations_[row_a]);
+  }
+
+  std::string name_;
+  int vertical_scans_{};
+  int horizontal_scans_{};
+  int ground_scan_idx_{};
+  float ang_res_x_{};
+  std::vector<float> elevations_;  // elevation of each ring (rad)
+  bool rings_top_down_{};          // drivers number the rings from the top beam (Ouster)
+
+private:
+  static const int ROW_LUT_SIZE = 4096;
+  static const int ATAN_LUT_SIZE = 4096;
+
+  // Arc tangent of t in [0, 1], in columns - linearly interpolated from the lookup table
+  float atanColumns(const float& t) const
+  {
+    float f = t * ATAN_LUT_SIZE;
+    auto i = static_cast<int>(f);
+    if (i >= ATAN_LUT_SIZE)
+    {
+      return atan_lut_[ATAN_LUT_SIZE];
+    }
+
+    return atan_lut_[i] + (f - static_cast<float>(i)) * (atan_lut_[i + 1] - atan_lut_[i]);
+  }
+
+  void uniformRings(const int& n, const float& bottom, const float& top)
+  {
+    for (int i = 0; i < n; i++)
+      elevations_.push_back(bottom + (top - bottom) * static_cast<float>(i) / static_cast<float>(n - 1));
+  }
+
+  void buildTables()
+  {
+    // Row table - indexed by the sine of the elevation, which is uniform enough near the horizon
+    // - each ring covers half of the gap to its neighbours, and the outer rings half of their inner gap
+    size_t n = elevations_.size();
+    std::vector<float> bounds(n + 1);
+    for (size_t i = 1; i < n; i++)
+      bounds[i] = (elevations_[i - 1] + elevations_[i]) / 2;
+    bounds[0] = elevations_[0] - (bounds[1] - elevations_[0]);
+    bounds[n] = elevations_[n - 1] + (elevations_[n - 1] - bounds[n - 1]);
+
+    row_lut_min_ = std::sin(bounds[0]);
+    row_lut_scale_ = ROW_LUT_SIZE / (std::sin(bounds[n]) - row_lut_min_);
+    row_lut_.resize(ROW_LUT_SIZE);
+    size_t ring = 0;
+    for (int bin = 0; bin < ROW_LUT_SIZE; bin++)
+    {
+      float elevation = std::asin(row_lut_min_ + (static_cast<float>(bin) + static_cast<float>(0.5)) / row_lut_scale_);
+      while (ring + 1 < n && elevation >= bounds[ring + 1])
+        ring++;
+      row_lut_[bin] = static_cast<int>(ring);
+    }
+
+    // Arc tangent table over [0, 1], in columns
+    quarter_turn_ = static_cast<float>(horizontal_scans_) / 4;
+    atan_lut_.resize(ATAN_LUT_SIZE + 1);
+    for (int i = 0; i <= ATAN_LUT_SIZE; i++)
+      atan_lut_[i] = std::atan(static_cast<float>(i) / ATAN_LUT_SIZE) / ang_res_x_;
+  }
+
+  std::vector<int> row_lut_;
+  float row_lut_min_{};
+  float row_lut_scale_{};
+  std::vector<float> atan_lut_;
+  float quarter_turn_{};
+};
+
+}  // namespace vineslam
@@ -11,7 +11,6 @@ const float DEGREE_TO_RAD = static_cast<float>(M_PI / 180.);
 const float RAD_TO_DEGREE = static_cast<float>(180. / M_PI);
 const float M_2PI = static_cast<float>(2. * M_PI);
 
-#define NUM_THREADS 8
 #define VERBOSE 1
 
 struct Const
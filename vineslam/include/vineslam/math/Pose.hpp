@@ -59,20 +59,28 @@ struct Pose
   }
 
   // Construct from set of poses
-  explicit Pose(const std::vector<Pose>& poses)
+  explicit Pose(const std::vector<Pose>& poses) : Pose(poses, [](const Pose& pose) -> const Pose& { return pose; })
+  {
+  }
+
+  // Mean pose and standard deviation of the poses held by a set of objects (e.g. particles)
+  // - pose_of returns the pose of each object, so the poses do not need to be copied to a new vector
+  template <typename Container, typename Accessor>
+  Pose(const Container& items, const Accessor& pose_of)
   {
     Pose mean(0., 0., 0., 0., 0., 0.);
     Pose mean_cos(0., 0., 0., 0., 0., 0.);
     Pose mean_sin(0., 0., 0., 0., 0., 0.);
     Point stdev(0., 0., 0.);
 
-    auto n_poses = static_cast<float>(poses.size());
+    auto n_poses = static_cast<float>(items.size());
 
     // Calculate mean of all the robot poses
     // - for the orientations: Mean of circular quantities
     //  (https://en.wikipedia.org/wiki/Mean_of_circular_quantities)
-    for (const auto& pose : poses)
+    for (const auto& item : items)
     {
+      const Pose& pose = pose_of(item);
       mean.x_ += pose.x_;
       mean.y_ += pose.y_;
       mean.z_ += pose.z_;
@@ -91,15 +99,16 @@ struct Pose
     mean.Y_ = std::atan2(mean_sin.Y_ / n_poses, mean_cos.Y_ / n_poses);
 
     // Calculate standard deviation of all the robot positions
-    for (const auto& pose : poses)
+    for (const auto& item : items)
     {
+      const Pose& pose = pose_of(item);
       stdev.x_ += std::pow(pose.x_ - mean.x_, 2);
       stdev.y_ += std::pow(pose.y_ - mean.y_, 2);
       stdev.z_ += std::pow(pose.z_ - mean.z_, 2);
     }
-    stdev.x_ = std::sqrt(stdev.x_ / static_cast<float>(poses.size()));
-    stdev.y_ = std::sqrt(stdev.y_ / static_cast<float>(poses.size()));
-    stdev.z_ = std::sqrt(stdev.z_ / static_cast<float>(poses.size()));
+    stdev.x_ = std::sqrt(stdev.x_ / n_poses);
+    stdev.y_ = std::sqrt(stdev.y_ / n_poses);
+    stdev.z_ = std::sqrt(stdev.z_ / n_poses);
 
     // Save pose and gaussian distribution
     (*this) = mean;
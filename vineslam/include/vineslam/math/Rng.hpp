@@ -0,0 +1,283 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+namespace vineslam
+{
+// xoshiro256** pseudo-random engine (http://prng.di.unimi.it/)
+// - satisfies UniformRandomBitGenerator, so it can also feed std:: distributions
+// - each instance holds its own state, which makes it safe to use one engine per thread
+struct Xoshiro256
+{
+  using result_type = uint64_t;
+
+  Xoshiro256()
+  {
+    seed(0);
+  }
+
+  explicit Xoshiro256(const uint64_t& s)
+  {
+    seed(s);
+  }
+
+  // Expand a 64 bit seed into the 256 bit state using splitmix64
+  void seed(uint64_t s)
+  {
+    for (auto& word : s_)
+    {
+      s += 0x9e3779b97f4a7c15ULL;
+      uint64_t z = s;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      word = z ^ (z >> 31);
+    }
+  }
+
+  result_type operator()()
+  {
+    const uint64_t result = rotl(s_[1] * 5, 7) * 9;
+    const uint64_t t = s_[1] << 17;
+
+    s_[2] ^= s_[0];
+    s_[3] ^= s_[1];
+    s_[1] ^= s_[2];
+    s_[0] ^= s_[3];
+    s_[2] ^= t;
+    s_[3] = rotl(s_[3], 45);
+
+    return result;
+  }
+
+  // Advance the state by 2^128 steps - used to create non-overlapping streams
+  void jump()
+  {
+    static const uint64_t jump_poly[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL,
+                                          0x39abdc4529b1661cULL };
+
+    std::array<uint64_t, 4> s{};
+    for (const auto& poly : jump_poly)
+    {
+      for (int b = 0; b < 64; b++)
+      {
+        if (poly & (static_cast<uint64_t>(1) << b))
+        {
+          s[0] ^= s_[0];
+          s[1] ^= s_[1];
+          s[2] ^= s_[2];
+          s[3] ^= s_[3];
+        }
+        (*this)();
+      }
+    }
+    s_ = s;
+  }
+
+  static constexpr result_type min()
+  {
+    return 0;
+  }
+  static constexpr result_type max()
+  {
+    return std::numeric_limits<result_type>::max();
+  }
+
+private:
+  static uint64_t rotl(const uint64_t& x, int k)
+  {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  std::array<uint64_t, 4> s_{};
+};
+
+// Ziggurat sampler for the standard normal distribution
+// - Marsaglia & Tsang, "The Ziggurat Method for Generating Random Variables", 2000
+// - 128 layers; ~99% of the samples cost one table lookup and one multiplication
+struct Ziggurat
+{
+  template <typename Engine>
+  static float gaussian(Engine& engine)
+  {
+    const Tables& t = tables();
+
+    while (true)
+    {
+      // The low 7 bits select the layer, the high 32 bits carry the signed abscissa
+      uint64_t bits = engine();
+      int iz = static_cast<int>(bits & 127);
+      auto hz = static_cast<int32_t>(bits >> 32);
+      uint32_t abs_hz = (hz < 0) ? static_cast<uint32_t>(-static_cast<int64_t>(hz)) : static_cast<uint32_t>(hz);
+
+      float x = static_cast<float>(hz) * t.wn[iz];
+      if (abs_hz < t.kn[iz])
+      {
+        return x;
+      }
+
+      if (iz == 0)
+      {
+        // Sample from the tail of the distribution
+        float y;
+        do
+        {
+          x = -std::log(uniformPositive(engine)) / R;
+          y = -std::log(uniformPositive(engine));
+        } while (y + y < x * x);
+
+        return (hz > 0) ? R + x : -R - x;
+      }
+
+      // Wedge rejection test
+      if (t.fn[iz] + uniformPositive(engine) * (t.fn[iz - 1] - t.fn[iz]) < std::exp(-0.5f * x * x))
+      {
+        return x;
+      }
+    }
+  }
+
+  // Uniform sample in (0, 1]
+  template <typename Engine>
+  static float uniformPositive(Engine& engine)
+  {
+    return (static_cast<float>(engine() >> 40) + 1.f) * (1.f / 16777216.f);
+  }
+
+private:
+  static constexpr float R = 3.442619855899f;
+
+  struct Tables
+  {
+    std::array<uint32_t, 128> kn;
+    std::array<float, 128> wn;
+    std::array<float, 128> fn;
+
+    Tables()
+    {
+      const double m1 = 2147483648.0;
+      const double vn = 9.91256303526217e-3;
+      double dn = R;
+      double tn = dn;
+      double q = vn / std::exp(-0.5 * dn * dn);
+
+      kn[0] = static_cast<uint32_t>((dn / q) * m1);
+      kn[1] = 0;
+      wn[0] = static_cast<float>(q / m1);
+      wn[127] = static_cast<float>(dn / m1);
+      fn[0] = 1.f;
+      fn[127] = static_cast<float>(std::exp(-0.5 * dn * dn));
+
+      for (int i = 126; i >= 1; i--)
+      {
+        dn = std::sqrt(-2. * std::log(vn / dn + std::exp(-0.5 * dn * dn)));
+        kn[i + 1] = static_cast<uint32_t>((dn / tn) * m1);
+        tn = dn;
+        fn[i] = static_cast<float>(std::exp(-0.5 * dn * dn));
+        wn[i] = static_cast<float>(dn / m1);
+      }
+    }
+  };
+
+  static const Tables& tables()
+  {
+    static const Tables t;
+    return t;
+  }
+};
+
+// Random number generator used across the library
+// - one instance per thread (or per task) - instances never share state
+// - seedable, so that runs are reproducible
+class Rng
+{
+public:
+  Rng() = default;
+
+  explicit Rng(const uint64_t& s) : engine_(s)
+  {
+  }
+
+  void seed(const uint64_t& s)
+  {
+    engine_.seed(s);
+  }
+
+  // Jump to the next non-overlapping sub-sequence of the generator
+  void jump()
+  {
+    engine_.jump();
+  }
+
+  // Uniform sample in [0, 1)
+  float uniform()
+  {
+    return static_cast<float>(engine_() >> 40) * (1.f / 16777216.f);
+  }
+
+  // Uniform integer in [0, n)
+  uint32_t uniformInt(const uint32_t& n)
+  {
+    return static_cast<uint32_t>(((engine_() >> 32) * static_cast<uint64_t>(n)) >> 32);
+  }
+
+  // Zero mean gaussian sample with a given standard deviation
+  float gaussian(const float& sigma = 1.)
+  {
+    return sigma * Ziggurat::gaussian(engine_);
+  }
+
+  Xoshiro256& engine()
+  {
+    return engine_;
+  }
+
+  // Set the seed from which the thread local generators are created
+  static void setGlobalSeed(const uint64_t& s)
+  {
+    globalSeed() = s;
+  }
+
+  // Generator of the stream id of the global seed
+  // - the stream is seeded from a hash of the global seed and of its id, so that it is set up in constant time and
+  //   is the same in every run, whatever the thread that asks for it
+  static Rng stream(const uint64_t& id)
+  {
+    return Rng(globalSeed().load() ^ mix(id + 1));
+  }
+
+  // Per-thread generator - it is on stream 0 until the owner of the thread gives it its own stream, with a stable id
+  // (e.g. a sensor index), through setThreadStream()
+  static Rng& threadLocal()
+  {
+    thread_local Rng rng = stream(0);
+    return rng;
+  }
+
+  static void setThreadStream(const uint64_t& id)
+  {
+    threadLocal() = stream(id);
+  }
+
+private:
+  static std::atomic<uint64_t>& globalSeed()
+  {
+    static std::atomic<uint64_t> s{ 0 };
+    return s;
+  }
+
+  // splitmix64 finalizer
+  static uint64_t mix(uint64_t z)
+  {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  Xoshiro256 engine_;
+};
+
+}  // namespace vineslam
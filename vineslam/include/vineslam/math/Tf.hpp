@@ -41,7 +41,7 @@ struct Tf
     return R_transpose;
   }
 
-  Tf operator*(const Tf& m_tf)
+  Tf operator*(const Tf& m_tf) const
   {
     std::array<float, 9> m_R{};
     std::array<float, 3> m_t{};
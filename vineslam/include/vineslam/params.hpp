@@ -14,6 +14,24 @@ struct Parameters
   std::string lidar_sensor_frame_{};
   std::string camera_sensor_frame_{};
 
+  // -----------------------------------
+  // ------ LiDAR sensor
+  // -----------------------------------
+  std::string lidar_sensor_{ "velodyne" };
+  std::string lidar_model_{ "vlp16" };
+  float lidar_height_{ 1.20 };
+  std::string lidar_segmentation_{ "bfs" };
+  std::string lidar_plane_extraction_{ "ransac" };
+  float lidar_voxel_size_{ 0. };
+  bool lidar_voxel_centroid_{};
+  // - field of view of the Livox sensors, around their main axis, and resolution of its bin grid (degrees)
+  float livox_fov_half_angle_{ 20. };
+  float livox_fov_bin_res_{ 0.5 };
+  // - additional LiDARs, each one given by its sensor, frame and model
+  std::vector<std::string> extra_lidar_sensors_;
+  std::vector<std::string> extra_lidar_frames_;
+  std::vector<std::string> extra_lidar_models_;
+
   // -----------------------------------
   // ------ System flags
   // -----------------------------------
@@ -33,6 +51,17 @@ struct Parameters
   bool save_logs_{};
   std::string logs_folder_{};
 
+  // -----------------------------------
+  // ------ Multithreading
+  // -----------------------------------
+  int num_threads_{};
+  int reserved_cores_{};
+  bool pin_threads_{};
+  // - number of thread pools that share the cores, and the one of the object built with these parameters
+  int thread_pools_{ 1 };
+  int thread_pool_idx_{};
+  bool pipelined_front_end_{};
+
   // -----------------------------------
   // ------ Map origin - datum
   // -----------------------------------
@@ -91,7 +120,15 @@ struct Parameters
   float sigma_RR_{};
   float sigma_PP_{};
   float sigma_YY_{};
-
+  int random_seed_{};
+  bool parallel_resampling_{};
+  float time_budget_{};
+  int fine_particles_{};
+  int coarse_subsampling_{};
+  bool reduced_state_{};
+  bool async_updates_{};
+  float async_resampling_neff_{ 0.5 };
+  int worker_processes_{};
 
   // -----------------------------------
   // ------ METHODS
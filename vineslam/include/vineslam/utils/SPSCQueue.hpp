@@ -0,0 +1,68 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace vineslam
+{
+// Bounded lock-free queue between a single producer thread and a single consumer thread
+// - it holds up to Capacity items in a ring buffer with one spare slot, so that a full queue is told apart from an
+//   empty one without a shared counter
+// - the producer only writes the tail and the consumer only writes the head, each of them publishing its slot to
+//   the other thread with a release store
+// - items are swapped in and out of the slots instead of moved, so that the buffers they own go round between the
+//   two threads and the slots, and keep their capacity
+template <typename T, size_t Capacity>
+class SPSCQueue
+{
+public:
+  // Swaps the item into the queue, handing back the contents of a consumed slot - returns false, leaving the item
+  // untouched, if the queue is full
+  bool push(T& item)
+  {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t next = increment(tail);
+    if (next == head_.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+
+    using std::swap;
+    swap(slots_[tail], item);
+    tail_.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // Swaps the oldest item out of the queue, leaving the previous contents of the item in its slot - returns false
+  // if the queue is empty
+  bool pop(T& item)
+  {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head == tail_.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+
+    using std::swap;
+    swap(slots_[head], item);
+    head_.store(increment(head), std::memory_order_release);
+    return true;
+  }
+
+private:
+  static size_t increment(const size_t& idx)
+  {
+    return (idx + 1 == Capacity + 1) ? 0 : idx + 1;
+  }
+
+  std::array<T, Capacity + 1> slots_;
+  // The indexes are padded apart, so that each thread does not invalidate the cache line the other one writes
+  // - padding instead of alignas, since over-aligned members are not honored by new before C++17
+  std::atomic<size_t> head_{ 0 };
+  char padding_[64];
+  std::atomic<size_t> tail_{ 0 };
+};
+
+}  // namespace vineslam
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace vineslam
+{
+// Runtime configuration of the worker threads used by the parallel stages of the system
+struct Threads
+{
+  // Cores on which this process is allowed to run
+  static std::vector<int> availableCores()
+  {
+    std::vector<int> cores;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+    {
+      for (int i = 0; i < CPU_SETSIZE; i++)
+      {
+        if (CPU_ISSET(i, &set))
+          cores.push_back(i);
+      }
+    }
+#endif
+    if (cores.empty())
+    {
+      for (int i = 0; i < static_cast<int>(std::max(std::thread::hardware_concurrency(), 1u)); i++)
+        cores.push_back(i);
+    }
+
+    return cores;
+  }
+
+  // Number of worker threads to launch
+  // - num_threads > 0 is used as is
+  // - num_threads = 0 uses all the available cores except the reserved ones
+  // - the threads are split between the n_pools thread pools that run at the same time, and pool_idx gets its share
+  static uint32_t count(const int& num_threads, const int& reserved_cores, const int& n_pools = 1,
+                        const int& pool_idx = 0)
+  {
+    int n_threads = num_threads;
+    if (n_threads <= 0)
+    {
+      int n_cores = static_cast<int>(availableCores().size());
+      n_threads = std::max(n_cores - std::max(reserved_cores, 0), 1);
+    }
+
+    int begin, end;
+    share(n_threads, n_pools, pool_idx, begin, end);
+    return static_cast<uint32_t>(std::max(end - begin, 1));
+  }
+
+  // Cores to which the workers of the pool pool_idx are pinned
+  // - the first reserved cores are left free for the rest of the system
+  // - the other ones are split in disjoint ranges between the n_pools thread pools, or shared round robin if there
+  //   are more pools than cores
+  static std::vector<int> pinningCores(const int& reserved_cores, const int& n_pools = 1, const int& pool_idx = 0)
+  {
+    std::vector<int> cores = availableCores();
+    auto n_reserved = static_cast<size_t>(std::max(reserved_cores, 0));
+    if (n_reserved < cores.size())
+      cores.erase(cores.begin(), cores.begin() + n_reserved);
+
+    int begin, end;
+    share(static_cast<int>(cores.size()), n_pools, pool_idx, begin, end);
+    if (begin == end)
+      return { cores[pool_idx % cores.size()] };
+
+    return std::vector<int>(cores.begin() + begin, cores.begin() + end);
+  }
+
+  // Pin a thread to a single core - returns false if the platform does not support it
+  static bool pin(std::thread& thread, const int& core)
+  {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    return pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set) == 0;
+#else
+    (void)thread;
+    (void)core;
+    return false;
+#endif
+  }
+
+private:
+  // Range [begin, end) of the n items that falls to the part part_idx, out of n_parts
+  static void share(const int& n, const int& n_parts, const int& part_idx, int& begin, int& end)
+  {
+    int parts = std::max(n_parts, 1);
+    int idx = std::min(std::max(part_idx, 0), parts - 1);
+    begin = (n * idx) / parts;
+    end = (n * (idx + 1)) / parts;
+  }
+};
+
+}  // namespace vineslam
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <cstdio>
 
 namespace vineslam
 {
@@ -11,12 +12,13 @@ class Timer
 public:
   Timer(const std::string& header)
   {
-    log_ = "";
+    log_.reserve(4096);
     prefix_ = "";
     header_ = header;
   }
 
-  void tick(const std::string& prefix)
+  // The prefix is not copied - it must be a string literal (or outlive the tock() call)
+  void tick(const char* prefix)
   {
     start_time_ = std::chrono::high_resolution_clock::now();
     prefix_ = prefix;
@@ -27,7 +29,10 @@ public:
     std::chrono::high_resolution_clock::time_point end_time = std::chrono::high_resolution_clock::now();
     float duration = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time_).count();
 
-    log_ += prefix_ + " took " + std::to_string(duration) + " ms.\n";
+    // Format in a stack buffer and append to the log, that keeps its capacity between clears
+    char line[256];
+    std::snprintf(line, sizeof(line), "%s took %f ms.\n", prefix_, duration);
+    log_ += line;
   }
 
   void getLog()
@@ -44,7 +49,7 @@ public:
 
 private:
   std::string log_;
-  std::string prefix_;
+  const char* prefix_;
   std::string header_;
   std::chrono::high_resolution_clock::time_point start_time_;
 };
@@ -11,23 +11,32 @@ Localizer::Localizer(Parameters params) : params_(std::move(params))
 void Localizer::init(const Pose& initial_pose)
 {
   // Initialize the particle filter
-  pf_ = new PF(params_, initial_pose);
+  // - a previous filter is kept, along with its scoring workers, and its particles are spread around the new pose
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (pf_ == nullptr)
+  {
+    pf_ = new PF(params_, initial_pose);
+  }
+  else
+  {
+    pf_->spreadParticles(initial_pose);
+  }
 
   // Compute average pose and standard deviation of the
   // first distribution
-  std::vector<Pose> poses;
-  for (auto& particle : pf_->particles_)
-    poses.push_back(particle.p_);
-  average_pose_ = Pose(poses);
+  average_pose_ = Pose(pf_->particles_, [](const Particle& particle) -> const Pose& { return particle.p_; });
   last_update_pose_ = initial_pose;
 
   p_odom_ = initial_pose;
   init_flag_ = true;
+  moved_since_resampling_ = false;
 }
 
-void Localizer::process(const Pose& wheel_odom_inc, const Observation& obsv, OccupancyMap* grid_map)
+void Localizer::process(const Pose& wheel_odom_inc, const Observation& obsv, OccupancyMap* grid_map,
+                        const float& time_budget)
 {
-  auto before = std::chrono::high_resolution_clock::now();
+  auto before = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
   // Resets
   pf_->w_sum_ = 0.;
 
@@ -41,10 +50,7 @@ void Localizer::process(const Pose& wheel_odom_inc, const Observation& obsv, Occ
   // ---------------- Draw particles using odometry motion model
   // ------------------------------------------------------------------------------
   pf_->motionModel(odom_inc);
-  // - Save not resampled particles
-  m_particles_.clear();
-  for (const auto& particle : pf_->particles_)
-    m_particles_.push_back(particle);
+  moved_since_resampling_ = true;
 
   Pose odom = p_odom_ + odom_inc;
   Pose delta_pose = odom - last_update_pose_;
@@ -56,44 +62,106 @@ void Localizer::process(const Pose& wheel_odom_inc, const Observation& obsv, Occ
     // ------------------------------------------------------------------------------
     // ---------------- Update particles weights using multi-layer map
     // ------------------------------------------------------------------------------
+    // - with a time budget, the update stops scoring particles when the budget expires
+    auto deadline = std::chrono::steady_clock::time_point::max();
+    if (time_budget > 0.)
+    {
+      deadline = before + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                              std::chrono::duration<float, std::milli>(time_budget));
+    }
     pf_->update(obsv.landmarks_, obsv.corners_, obsv.planars_, obsv.planes_, obsv.ground_plane_, obsv.gps_pose_,
-                obsv.imu_pose_, grid_map);
-
-    // ------------------------------------------------------------------------------
-    // ---------------- Normalize particle weights
-    // ------------------------------------------------------------------------------
-    pf_->normalizeWeights();
+                obsv.imu_pose_, grid_map, deadline);
 
     // ------------------------------------------------------------------------------
-    // ---------------- Resample particles
+    // ---------------- Normalize particle weights and resample particles
     // ------------------------------------------------------------------------------
-    pf_->resample();
+    if (params_.parallel_resampling_)
+    {
+      pf_->systematicResample();
+    }
+    else
+    {
+      pf_->normalizeWeights();
+      pf_->resample();
+    }
 
     last_update_pose_ = odom;
     init_flag_ = false;
+    moved_since_resampling_ = false;
   }
 
   // - Compute final robot pose using the mean of the particles poses
-  std::vector<Pose> poses;
-  for (const auto& particle : pf_->particles_)
-    poses.push_back(particle.p_);
-  average_pose_ = Pose(poses);
+  average_pose_ = Pose(pf_->particles_, [](const Particle& particle) -> const Pose& { return particle.p_; });
 
   // - Save current control to use in the next iteration
   p_odom_ = odom;
 
   // - Save pf logs
-  auto after = std::chrono::high_resolution_clock::now();
+  auto after = std::chrono::steady_clock::now();
   std::chrono::duration<float, std::milli> duration = after - before;
 }
 
+void Localizer::processGPS(const Pose& gps_pose)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (pf_ == nullptr)
+  {
+    return;
+  }
+
+  if (pf_->updateGPS(gps_pose))
+  {
+    resampleIfDegenerate();
+  }
+}
+
+void Localizer::processIMU(const Pose& imu_pose)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (pf_ == nullptr)
+  {
+    return;
+  }
+
+  if (pf_->updateIMU(imu_pose))
+  {
+    resampleIfDegenerate();
+  }
+}
+
+void Localizer::resampleIfDegenerate()
+{
+  if (!moved_since_resampling_ ||
+      pf_->effectiveSampleSize() >= params_.async_resampling_neff_ * static_cast<float>(pf_->particles_.size()))
+  {
+    return;
+  }
+
+  pf_->takeAccumulatedWeights();
+  if (params_.parallel_resampling_)
+  {
+    pf_->systematicResample();
+  }
+  else
+  {
+    pf_->normalizeWeights();
+    pf_->resample();
+  }
+
+  moved_since_resampling_ = false;
+
+  average_pose_ = Pose(pf_->particles_, [](const Particle& particle) -> const Pose& { return particle.p_; });
+}
+
 Pose Localizer::getPose() const
 {
+  std::lock_guard<std::mutex> lock(mutex_);
   return average_pose_;
 }
 
 void Localizer::getParticles(std::vector<Particle>& in) const
 {
+  std::lock_guard<std::mutex> lock(mutex_);
   in.resize(pf_->particles_.size());
   for (size_t i = 0; i < in.size(); i++)
     in[i] = pf_->particles_[i];
@@ -101,7 +169,20 @@ void Localizer::getParticles(std::vector<Particle>& in) const
 
 void Localizer::changeGPSFlag(const bool& val)
 {
+  std::lock_guard<std::mutex> lock(mutex_);
   pf_->use_gps_ = val;
 }
 
+void Localizer::setElevationMap(ElevationMap* elevation_map)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  pf_->setElevationMap(elevation_map);
+}
+
+void Localizer::spawnWorkers(OccupancyMap* grid_map)
+{
+  // No lock is taken, so that it is not held across the fork - the localizer is not shared yet
+  pf_->spawnWorkers(grid_map);
+}
+
 }  // namespace vineslam
@@ -1,7 +1,21 @@
 #include "../../include/vineslam/localization/pf.hpp"
 
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+
 namespace vineslam
 {
+// Maximum number of corners and planars per update that can be sent to the scoring workers
+// - Tf, Corner and Planar only hold plain values, so they are copied as they are into the shared segment
+static const size_t MAX_SHARED_FEATURES = 1 << 16;
+// Time (s) to wait for the scoring workers before falling back to in-process scoring
+static const time_t WORKERS_TIMEOUT = 2;
+
 PF::PF(const Parameters& params, const Pose& initial_pose) : params_(params)
 {
   // - General parameters
@@ -12,17 +26,83 @@ PF::PF(const Parameters& params, const Pose& initial_pose) : params_(params)
   use_imu_ = params.use_imu_;
   particles_size_ = params.number_particles_;
 
+  // Split the particles in blocks to process in parallel
+  n_threads_ = Threads::count(params.num_threads_, params.reserved_cores_, params.thread_pools_,
+                              params.thread_pool_idx_);
+  n_blocks_ = n_threads_;
+
+  // Initialize the random number generators
+  // - the motion model uses one independent stream per block
+  rng_.seed(params.random_seed_);
+  Rng stream = rng_;
+  for (uint32_t i = 0; i < n_blocks_; i++)
+  {
+    stream.jump();
+    rng_streams_.push_back(stream);
+  }
+
   // Initialize thread pool
+  // - with a single thread, no workers are launched and the tasks run in the calling thread
   thread_pool_ = new lama::ThreadPool;
-  thread_pool_->init(NUM_THREADS);
+  if (n_threads_ > 1)
+  {
+    thread_pool_->init(n_threads_);
+
+    if (params.pin_threads_)
+    {
+      std::vector<int> cores =
+          Threads::pinningCores(params.reserved_cores_, params.thread_pools_, params.thread_pool_idx_);
+      for (size_t i = 0; i < thread_pool_->workers.size(); i++)
+        Threads::pin(thread_pool_->workers[i], cores[i % cores.size()]);
+    }
+  }
 
   // Initialize profiler
   t_ = new Timer("Particle Filter");
 
   // Initialize normal distributions
   particles_.resize(particles_size_);
+  motion_buf_.resize(12 * particles_size_);
+  for (auto* ws : { &semantic_weights_, &corner_weights_, &planar_weights_, &planes_weights_, &ground_weights_,
+                    &surf_weights_, &gps_weights_, &imu_weights_, &coarse_corners_, &coarse_planars_, &coarse_score_ })
+  {
+    ws->resize(particles_size_);
+  }
+  async_weights_.assign(particles_size_, 1.);
+  scored_.resize(particles_size_);
+  order_.resize(particles_size_);
+  ground_planes_.resize(1);
+  resample_idx_.resize(particles_size_);
+  offspring_.resize(particles_size_);
+  free_slots_.resize(particles_size_);
+  extra_src_.resize(particles_size_);
+  block_sum_.resize(n_blocks_ + 1);
+  block_free_.resize(n_blocks_ + 1);
+  block_extra_.resize(n_blocks_ + 1);
 
   // Initialize all particles
+  spreadParticles(initial_pose);
+
+  // Set filter settings
+  sigma_landmark_matching_ = 0.1;
+  sigma_feature_matching_ = 0.1;
+  sigma_corner_matching_ = 0.1;
+  sigma_planar_matching_ = 0.1;
+  sigma_plane_matching_vector_ = 0.02;
+  sigma_plane_matching_centroid_ = 0.10;
+  sigma_gps_ = 0.05;
+  sigma_imu_ = 5 * DEGREE_TO_RAD;
+}
+
+PF::~PF()
+{
+  stopWorkers();
+  delete thread_pool_;
+  delete t_;
+}
+
+void PF::spreadParticles(const Pose& initial_pose)
+{
   for (size_t i = 0; i < particles_size_; i++)
   {
     // Calculate the initial pose for each particle considering
@@ -36,78 +116,111 @@ PF::PF(const Parameters& params, const Pose& initial_pose) : params_(params)
     // Insert the particle into the particles array
     particles_[i] = Particle(i, m_pose, weight);
   }
-
-  // Set filter settings
-  sigma_landmark_matching_ = 0.1;
-  sigma_feature_matching_ = 0.1;
-  sigma_corner_matching_ = 0.1;
-  sigma_planar_matching_ = 0.1;
-  sigma_plane_matching_vector_ = 0.02;
-  sigma_plane_matching_centroid_ = 0.10;
-  sigma_gps_ = 0.05;
-  sigma_imu_ = 5 * DEGREE_TO_RAD;
+  std::fill(async_weights_.begin(), async_weights_.end(), 1.);
 }
 
-// Samples a zero mean Gaussian
-// See https://www.taygeta.com/random/gaussian.html
+// Samples a zero mean Gaussian using the Ziggurat method
 float PF::sampleGaussian(const float& sigma, const unsigned long int& S)
 {
   if (S != 0)
-    srand48(S);
+    rng_.seed(S);
   if (sigma == 0)
     return 0.;
 
-  float x1, x2, w;
-  float r;
-
-  do
-  {
-    do
-    {
-      r = drand48();
-    } while (r == 0.0);
-    x1 = 2.0 * r - 1.0;
-    do
-    {
-      r = drand48();
-    } while (r == 0.0);
-    x2 = 2.0 * drand48() - 1.0;
-    w = x1 * x1 + x2 * x2;
-  } while (w > 1.0 || w == 0.0);
-
-  return (sigma * x2 * sqrt(-2.0 * log(w) / w));
+  return rng_.gaussian(sigma);
 }
 
 void PF::motionModel(const Pose& odom_inc)
 {
   float d_trans = odom_inc.norm3D();
 
-  // Innovate particles
-  for (auto& particle : particles_)
+  // Build odom increment transformation matrix (common to all the particles)
+  std::array<float, 9> R_inc{};
+  odom_inc.toRotMatrix(R_inc);
+  Tf odom_inc_tf(R_inc, std::array<float, 3>{ odom_inc.x_, odom_inc.y_, odom_inc.z_ });
+
+  // Innovate particles - each block of particles uses its own random stream
+  forEachBlock([this, &odom_inc_tf, d_trans](const uint32_t& t, const uint32_t& begin, const uint32_t& end) {
+    motionModel(odom_inc_tf, d_trans, rng_streams_[t], begin, end);
+  });
+}
+
+void PF::motionModel(const Tf& odom_inc_tf, const float& d_trans, Rng& rng, const uint32_t& begin,
+                     const uint32_t& end)
+{
+  const uint32_t n = end - begin;
+
+  // Scratch memory of this block, as a structure of arrays:
+  // - the noise of each of the 6 DoF and the sines/cosines of the noise angles
+  float* x = motion_buf_.data() + 12 * begin;
+  float* y = x + n;
+  float* z = y + n;
+  float* R = z + n;
+  float* P = R + n;
+  float* Y = P + n;
+  float* cR = Y + n;
+  float* sR = cR + n;
+  float* cP = sR + n;
+  float* sP = cP + n;
+  float* cY = sP + n;
+  float* sY = cY + n;
+
+  // Sample all the noise in bulk
+  // - in the reduced state only x, y and yaw are sampled, the remaining DoFs come from the terrain
+  if (params_.reduced_state_)
+  {
+    for (uint32_t i = 0; i < 2 * n; i++)
+      x[i] = rng.gaussian();
+    for (uint32_t i = 0; i < n; i++)
+      Y[i] = rng.gaussian();
+    std::fill(z, z + 3 * n, 0.);
+  }
+  else
   {
-    // Build pose noise transformation matrix
-    Pose pose_noise(params_.sigma_xx_, params_.sigma_yy_, params_.sigma_zz_, params_.sigma_RR_, params_.sigma_PP_,
-                    params_.sigma_YY_);
+    for (uint32_t i = 0; i < 6 * n; i++)
+      x[i] = rng.gaussian();
+  }
 
-    std::array<float, 6> gaussian_noise{};
-    for (float& i : gaussian_noise)
-      i = (d_trans /* + d_rot*/) * sampleGaussian(1.0);
+  // Scale the noise by the odometry displacement and by the motion model standard deviations
+  const float s_x = d_trans * params_.sigma_xx_;
+  const float s_y = d_trans * params_.sigma_yy_;
+  const float s_z = d_trans * params_.sigma_zz_;
+  const float s_R = d_trans * params_.sigma_RR_;
+  const float s_P = d_trans * params_.sigma_PP_;
+  const float s_Y = d_trans * params_.sigma_YY_;
+  for (uint32_t i = 0; i < n; i++)
+  {
+    x[i] *= s_x;
+    y[i] *= s_y;
+    z[i] *= s_z;
+    R[i] *= s_R;
+    P[i] *= s_P;
+    Y[i] *= s_Y;
+  }
 
-    pose_noise.x_ *= gaussian_noise[0];  // xx
-    pose_noise.y_ *= gaussian_noise[1];  // yy
-    pose_noise.z_ *= gaussian_noise[2];  // zz
-    pose_noise.R_ *= gaussian_noise[3];  // RR
-    pose_noise.P_ *= gaussian_noise[4];  // PP
-    pose_noise.Y_ *= gaussian_noise[5];  // YY
+  // Batched trigonometry of the noise angles
+  for (uint32_t i = 0; i < n; i++)
+  {
+    cR[i] = std::cos(R[i]);
+    sR[i] = std::sin(R[i]);
+    cP[i] = std::cos(P[i]);
+    sP[i] = std::sin(P[i]);
+    cY[i] = std::cos(Y[i]);
+    sY[i] = std::sin(Y[i]);
+  }
 
-    std::array<float, 9> R_noise{};
-    pose_noise.toRotMatrix(R_noise);
-    Tf odom_noise_tf(R_noise, std::array<float, 3>{ pose_noise.x_, pose_noise.y_, pose_noise.z_ });
+  for (uint32_t i = 0; i < n; i++)
+  {
+    Particle& particle = particles_[begin + i];
 
-    // Built odom increment transformation matrix
-    std::array<float, 9> R_inc{};
-    odom_inc.toRotMatrix(R_inc);
-    Tf odom_inc_tf(R_inc, std::array<float, 3>{ odom_inc.x_, odom_inc.y_, odom_inc.z_ });
+    // Build pose noise transformation matrix (same convention as Pose::toRotMatrix)
+    float cc = cR[i] * cY[i];
+    float cs = cR[i] * sY[i];
+    float sc = sR[i] * cY[i];
+    float ss = sR[i] * sY[i];
+    Tf odom_noise_tf(std::array<float, 9>{ cP[i] * cY[i], sP[i] * sc - cs, sP[i] * cc + ss, cP[i] * sY[i],
+                                           sP[i] * ss + cc, sP[i] * cs - sc, -sP[i], cP[i] * sR[i], cP[i] * cR[i] },
+                     std::array<float, 3>{ x[i], y[i], z[i] });
 
     // Final pose increment
     Tf innovation_tf = odom_inc_tf * odom_noise_tf;
@@ -119,21 +232,109 @@ void PF::motionModel(const Pose& odom_inc)
     // Apply transformation
     particle.tf_ = particle.ptf_ * innovation_tf;
     particle.p_ = Pose(particle.tf_.R_array_, particle.tf_.t_array_);
+
+    // Project the particle onto the terrain
+    if (params_.reduced_state_ && constrainToTerrain(particle.p_))
+    {
+      std::array<float, 9> Rot{};
+      particle.p_.toRotMatrix(Rot);
+      particle.tf_ = Tf(Rot, std::array<float, 3>{ particle.p_.x_, particle.p_.y_, particle.p_.z_ });
+    }
   }
 }
 
+bool PF::constrainToTerrain(Pose& pose) const
+{
+  if (elevation_map_ == nullptr)
+  {
+    return false;
+  }
+
+  // Fit the plane z = a*u + b*v + c to the elevation of the cells under the robot footprint, where (u,v) are the
+  // cell coordinates on the robot frame - this way, a and b are directly the forward and lateral slopes
+  float cy = std::cos(pose.Y_);
+  float sy = std::sin(pose.Y_);
+  float res = elevation_map_->resolution_;
+  float suu = 0., suv = 0., svv = 0., su = 0., sv = 0., sz = 0., suz = 0., svz = 0.;
+  int n = 0;
+  for (float u = -params_.robot_dim_x_ / 2; u <= params_.robot_dim_x_ / 2; u += res)
+  {
+    for (float v = -params_.robot_dim_y_ / 2; v <= params_.robot_dim_y_ / 2; v += res)
+    {
+      float z;
+      if (!elevation_map_->getElevation(pose.x_ + u * cy - v * sy, pose.y_ + u * sy + v * cy, z))
+      {
+        continue;
+      }
+
+      suu += u * u;
+      suv += u * v;
+      svv += v * v;
+      su += u;
+      sv += v;
+      sz += z;
+      suz += u * z;
+      svz += v * z;
+      n++;
+    }
+  }
+
+  if (n == 0)
+  {
+    return false;
+  }
+
+  // Solve the normal equations using the Cramer's rule
+  // | suu suv su | |a|   |suz|
+  // | suv svv sv | |b| = |svz|
+  // | su  sv  n  | |c|   |sz |
+  float fn = static_cast<float>(n);
+  float det = suu * (svv * fn - sv * sv) - suv * (suv * fn - sv * su) + su * (suv * sv - svv * su);
+  if (n < 3 || std::fabs(det) < 1e-6)
+  {
+    // Not enough cells to fit a plane - use only the mean height
+    pose.z_ = sz / fn;
+    return true;
+  }
+
+  float a = (suz * (svv * fn - sv * sv) - suv * (svz * fn - sv * sz) + su * (svz * sv - svv * sz)) / det;
+  float b = (suu * (svz * fn - sv * sz) - suz * (suv * fn - sv * su) + su * (suv * sz - svz * su)) / det;
+  float c = (suu * (svv * sz - sv * svz) - suv * (suv * sz - svz * su) + suz * (suv * sv - svv * su)) / det;
+
+  // The ground normal is (-a, -b, 1) on the robot frame, and the robot z axis is
+  // (cos(R)*sin(P), -sin(R), cos(R)*cos(P)) after removing the yaw rotation
+  pose.z_ = c;
+  pose.P_ = std::atan(-a);
+  pose.R_ = std::asin(b / std::sqrt(1 + a * a + b * b));
+
+  return true;
+}
+
+void PF::setElevationMap(ElevationMap* elevation_map)
+{
+  elevation_map_ = elevation_map;
+}
+
 void PF::update(const std::vector<SemanticFeature>& landmarks, const std::vector<Corner>& corners,
                 const std::vector<Planar>& planars, const std::vector<SemiPlane>& planes, const SemiPlane& ground_plane,
-                const Pose& gps_pose, const Pose& imu_pose, OccupancyMap* grid_map)
+                const Pose& gps_pose, const Pose& imu_pose, OccupancyMap* grid_map,
+                const std::chrono::steady_clock::time_point& deadline)
 {
-  std::vector<float> semantic_weights(particles_size_, 0.);
-  std::vector<float> corner_weights(particles_size_, 0.);
-  std::vector<float> planar_weights(particles_size_, 0.);
-  std::vector<float> planes_weights(particles_size_, 0.);
-  std::vector<float> ground_weights(particles_size_, 0.);
-  std::vector<float> surf_weights(particles_size_, 0.);
-  std::vector<float> gps_weights(particles_size_, 0.);
-  std::vector<float> imu_weights(particles_size_, 0.);
+  // Reset the update workspace
+  std::vector<float>& semantic_weights = semantic_weights_;
+  std::vector<float>& corner_weights = corner_weights_;
+  std::vector<float>& planar_weights = planar_weights_;
+  std::vector<float>& planes_weights = planes_weights_;
+  std::vector<float>& ground_weights = ground_weights_;
+  std::vector<float>& surf_weights = surf_weights_;
+  std::vector<float>& gps_weights = gps_weights_;
+  std::vector<float>& imu_weights = imu_weights_;
+  for (auto* ws : { &semantic_weights, &corner_weights, &planar_weights, &planes_weights, &ground_weights,
+                    &surf_weights, &gps_weights, &imu_weights })
+  {
+    std::fill(ws->begin(), ws->end(), 0.);
+  }
+  ground_planes_[0] = ground_plane;
 
   // if (use_semantic_features_)
   if (0)
@@ -143,28 +344,121 @@ void PF::update(const std::vector<SemanticFeature>& landmarks, const std::vector
     t_->tock();
   }
 
-  if (use_lidar_features_)
+  // Particles whose LiDAR layers were scored - all of them, unless the deadline expires or the
+  // coarse-to-fine mode is active
+  std::vector<uint8_t>& scored = scored_;
+  std::fill(scored.begin(), scored.end(), 1);
+  uint32_t n_scored = particles_size_;
+
+  // Coarse-to-fine scoring is used if only part of the particles are set to be fully scored
+  bool coarse_to_fine = params_.fine_particles_ > 0 && static_cast<uint32_t>(params_.fine_particles_) < particles_size_;
+
+  if (use_lidar_features_ && deadline == std::chrono::steady_clock::time_point::max() && !coarse_to_fine)
   {
-    t_->tick("pf::corners()");
-    mediumLevelCorners(corners, grid_map, corner_weights);
-    t_->tock();
+    bool scored_in_workers = false;
+    if (!workers_.empty())
+    {
+      t_->tick("pf::workers()");
+      scored_in_workers = scoreInWorkers(corners, planars, corner_weights, planar_weights);
+      t_->tock();
+    }
 
-    t_->tick("pf::planars()");
-    mediumLevelPlanars(planars, grid_map, planar_weights);
-    t_->tock();
+    if (!scored_in_workers)
+    {
+      t_->tick("pf::corners()");
+      mediumLevelCorners(corners, grid_map, corner_weights);
+      t_->tock();
+
+      t_->tick("pf::planars()");
+      mediumLevelPlanars(planars, grid_map, planar_weights);
+      t_->tock();
+    }
 
     t_->tick("pf::planes()");
-    mediumLevelPlanes({ ground_plane }, grid_map, ground_weights);
+    mediumLevelPlanes(ground_planes_, grid_map, ground_weights);
     mediumLevelPlanes(planes, grid_map, planes_weights);
     t_->tock();
   }
+  else if (use_lidar_features_)
+  {
+    // Particles are scored one at a time, on all the LiDAR layers, by priority order:
+    // - by decreasing prior weight, until the deadline expires
+    // - in coarse-to-fine mode, by decreasing coarse score, until the deadline expires or the top-K are scored
+    std::vector<uint32_t>& order = order_;
+    std::iota(order.begin(), order.end(), 0);
+    uint32_t n_fine = particles_size_;
+
+    if (coarse_to_fine)
+    {
+      // Coarse stage - score all the particles with a subsampled set of corners and planars
+      t_->tick("pf::lidar_coarse()");
+      auto stride = static_cast<size_t>(std::max(params_.coarse_subsampling_, 1));
+      std::vector<float>& coarse_corners = coarse_corners_;
+      std::vector<float>& coarse_planars = coarse_planars_;
+      forEachBlock([&](const uint32_t&, const uint32_t& begin, const uint32_t& end) {
+        for (uint32_t i = begin; i < end; i++)
+        {
+          coarse_corners[i] = cornerWeight(particles_[i], corners, grid_map, stride);
+          coarse_planars[i] = planarWeight(particles_[i], planars, grid_map, stride);
+        }
+      });
+
+      float coarse_corners_max = *std::max_element(coarse_corners.begin(), coarse_corners.end());
+      float coarse_planars_max = *std::max_element(coarse_planars.begin(), coarse_planars.end());
+      std::vector<float>& coarse_score = coarse_score_;
+      for (uint32_t i = 0; i < particles_size_; i++)
+      {
+        float m_cw = (coarse_corners_max > 0.) ? coarse_corners[i] / coarse_corners_max : static_cast<float>(1.);
+        float m_rw = (coarse_planars_max > 0.) ? coarse_planars[i] / coarse_planars_max : static_cast<float>(1.);
+        coarse_score[i] = m_cw * m_rw;
+      }
+
+      // Fine stage candidates - the top-K particles of the coarse stage
+      n_fine = static_cast<uint32_t>(params_.fine_particles_);
+      std::partial_sort(
+          order.begin(), order.begin() + n_fine, order.end(),
+          [&coarse_score](const uint32_t& a, const uint32_t& b) { return coarse_score[a] > coarse_score[b]; });
+      t_->tock();
+    }
+    else
+    {
+      // - ties are broken by index, which keeps the order deterministic without the buffer of std::stable_sort
+      std::sort(order.begin(), order.end(), [this](const uint32_t& a, const uint32_t& b) {
+        return particles_[a].w_ > particles_[b].w_ || (particles_[a].w_ == particles_[b].w_ && a < b);
+      });
+    }
+
+    std::fill(scored.begin(), scored.end(), 0);
+    std::atomic<uint32_t> next{ 0 };
+    std::atomic<uint32_t> n_done{ 0 };
+
+    // One task per block, each taking the next particle in the priority order while there is time left
+    t_->tick("pf::lidar_fine()");
+    forEachBlock([&](const uint32_t&, const uint32_t&, const uint32_t&) {
+      uint32_t k;
+      while (std::chrono::steady_clock::now() < deadline && (k = next++) < n_fine)
+      {
+        const Particle& particle = particles_[order[k]];
+        corner_weights[particle.id_] = cornerWeight(particle, corners, grid_map);
+        planar_weights[particle.id_] = planarWeight(particle, planars, grid_map);
+        ground_weights[particle.id_] = planeWeight(particle, ground_planes_, grid_map);
+        planes_weights[particle.id_] = planeWeight(particle, planes, grid_map);
+        scored[particle.id_] = 1;
+        n_done++;
+      }
+    });
+    t_->tock();
+
+    n_scored = n_done;
+  }
 
-  if (use_gps_)
+  // In the asynchronous mode, the GPS and IMU layers are applied on their own as soon as their measurements arrive
+  if (use_gps_ && !params_.async_updates_)
   {
     gps(gps_pose, gps_weights);
   }
 
-  if (use_imu_)
+  if (use_imu_ && !params_.async_updates_)
   {
     imu(imu_pose, imu_weights);
   }
@@ -178,21 +472,58 @@ void PF::update(const std::vector<SemanticFeature>& landmarks, const std::vector
   float surf_max = *std::max_element(surf_weights.begin(), surf_weights.end());
   float gps_max = *std::max_element(gps_weights.begin(), gps_weights.end());
   float imu_max = *std::max_element(imu_weights.begin(), imu_weights.end());
+  auto lidar_weight = [&](const uint32_t& id) {
+    float m_cw = (corners_max > 0.) ? corner_weights[id] : static_cast<float>(1.);
+    float m_rw = (planars_max > 0.) ? planar_weights[id] : static_cast<float>(1.);
+    float m_pw = (planes_max > 0.) ? planes_weights[id] : static_cast<float>(1.);
+    float m_gw = (ground_max > 0.) ? ground_weights[id] : static_cast<float>(1.);
+    return m_cw * m_rw * m_pw * m_gw;
+  };
+
+  // In coarse-to-fine mode, the particles left out of the fine stage take their coarse score as LiDAR weight,
+  // scaled so that the best of them matches the worst fine weight - the resampling then still draws from the whole
+  // set, and keeps the spread rebuilt by the motion model
+  float coarse_scale = 0.;
+  if (coarse_to_fine && n_scored > 0 && n_scored < particles_size_)
+  {
+    float min_fine = std::numeric_limits<float>::max();
+    float max_coarse = 0.;
+    for (uint32_t i = 0; i < particles_size_; i++)
+    {
+      if (scored[i])
+        min_fine = std::min(min_fine, lidar_weight(i));
+      else
+        max_coarse = std::max(max_coarse, coarse_score_[i]);
+    }
+    coarse_scale = (max_coarse > 0.) ? min_fine / max_coarse : static_cast<float>(0.);
+  }
+
   for (auto& particle : particles_)
   {
+    // If the deadline expired, the particles with no LiDAR score, fine or coarse, are dropped. If none was scored,
+    // the LiDAR layers are simply left out of this update.
+    float m_lidarw = lidar_weight(particle.id_);
+    if (n_scored > 0 && !scored[particle.id_])
+    {
+      if (!coarse_to_fine)
+      {
+        particle.w_ = 0.;
+        continue;
+      }
+      m_lidarw = coarse_score_[particle.id_] * coarse_scale;
+    }
+
     float m_lw = (semantic_max > 0.) ? semantic_weights[particle.id_] : static_cast<float>(1.);
-    float m_cw = (corners_max > 0.) ? corner_weights[particle.id_] : static_cast<float>(1.);
-    float m_rw = (planars_max > 0.) ? planar_weights[particle.id_] : static_cast<float>(1.);
-    float m_pw = (planes_max > 0.) ? planes_weights[particle.id_] : static_cast<float>(1.);
-    float m_gw = (ground_max > 0.) ? ground_weights[particle.id_] : static_cast<float>(1.);
     float m_sw = (surf_max > 0.) ? surf_weights[particle.id_] : static_cast<float>(1.);
     float m_gpsw = (gps_max > 0.) ? gps_weights[particle.id_] : static_cast<float>(1.);
     float m_iw = (imu_max > 0.) ? imu_weights[particle.id_] : static_cast<float>(1.);
 
-    particle.w_ = m_lw * m_cw * m_rw * m_pw * m_gw * m_sw * m_gpsw * m_iw;
+    // - the GPS and IMU layers received asynchronously since the last resampling are folded in here
+    particle.w_ = m_lw * m_lidarw * m_sw * m_gpsw * m_iw * async_weights_[particle.id_];
 
     w_sum_ += particle.w_;
   }
+  std::fill(async_weights_.begin(), async_weights_.end(), 1.);
 
   t_->getLog();
   t_->clearLog();
@@ -253,6 +584,77 @@ void PF::gps(const Pose& gps_pose, std::vector<float>& ws)
   }
 }
 
+bool PF::updateGPS(const Pose& gps_pose)
+{
+  if (!use_gps_)
+  {
+    return false;
+  }
+
+  gps(gps_pose, gps_weights_);
+  return accumulateWeights(gps_weights_);
+}
+
+bool PF::updateIMU(const Pose& imu_pose)
+{
+  if (!use_imu_)
+  {
+    return false;
+  }
+
+  imu(imu_pose, imu_weights_);
+  return accumulateWeights(imu_weights_);
+}
+
+bool PF::accumulateWeights(const std::vector<float>& ws)
+{
+  float w_max = *std::max_element(ws.begin(), ws.end());
+  if (w_max <= 0.)
+  {
+    return false;
+  }
+
+  // The accumulated weights are rescaled to a maximum of 1, so that they do not underflow between resamplings
+  float acc_max = 0.;
+  for (uint32_t i = 0; i < particles_size_; i++)
+  {
+    async_weights_[i] *= ws[i] / w_max;
+    acc_max = std::max(acc_max, async_weights_[i]);
+  }
+  if (acc_max <= 0.)
+  {
+    std::fill(async_weights_.begin(), async_weights_.end(), 1.);
+    return false;
+  }
+  for (auto& w : async_weights_)
+    w /= acc_max;
+
+  return true;
+}
+
+float PF::effectiveSampleSize() const
+{
+  float sum = 0., sum_sq = 0.;
+  for (const auto& w : async_weights_)
+  {
+    sum += w;
+    sum_sq += w * w;
+  }
+
+  return (sum_sq > 0.) ? sum * sum / sum_sq : static_cast<float>(particles_size_);
+}
+
+void PF::takeAccumulatedWeights()
+{
+  w_sum_ = 0.;
+  for (auto& particle : particles_)
+  {
+    particle.w_ = async_weights_[particle.id_];
+    w_sum_ += particle.w_;
+  }
+  std::fill(async_weights_.begin(), async_weights_.end(), 1.);
+}
+
 void PF::imu(const Pose& imu_pose, std::vector<float>& ws)
 {
   float normalizer_imu = static_cast<float>(1.) / (sigma_imu_ * std::sqrt(M_2PI));
@@ -278,9 +680,7 @@ void PF::highLevel(const std::vector<SemanticFeature>& landmarks, OccupancyMap*
   // Loop over all particles
   for (uint32_t i = 0; i < particles_size_; ++i)
   {
-#if NUM_THREADS > 1
-    thread_pool_->enqueue([this, landmarks, grid_map, normalizer_landmark, &ws, i]() {
-#endif
+    thread_pool_->enqueue([this, &landmarks, grid_map, normalizer_landmark, &ws, i]() {
       // Convert particle orientation to rotation matrix
       Pose l_pose = particles_[i].p_;
       l_pose.R_ = 0.;
@@ -367,309 +767,298 @@ void PF::highLevel(const std::vector<SemanticFeature>& landmarks, OccupancyMap*
 
       ws[particles_[i].id_] = w_landmarks;
 
-#if NUM_THREADS > 1
     });
-#endif
   }
 
-#if NUM_THREADS > 1
   thread_pool_->wait();
-#endif
 }
 
 void PF::mediumLevelCorners(const std::vector<Corner>& corners, OccupancyMap* grid_map, std::vector<float>& ws)
+{
+  // Loop over all particles
+  forEachBlock([this, &corners, grid_map, &ws](const uint32_t&, const uint32_t& begin, const uint32_t& end) {
+    for (uint32_t i = begin; i < end; i++)
+      ws[particles_[i].id_] = cornerWeight(particles_[i], corners, grid_map);
+  });
+}
+
+float PF::cornerWeight(const Particle& particle, const std::vector<Corner>& corners, OccupancyMap* grid_map,
+                       const size_t& stride) const
 {
   float normalizer_corner = static_cast<float>(1.) / (sigma_corner_matching_ * std::sqrt(M_2PI));
 
-  // Loop over all particles
-  for (uint32_t i = 0; i < particles_size_; ++i)
+  // ------------------------------------------------------
+  // --- 3D corner map fitting
+  // ------------------------------------------------------
+  float w_corners = 0;
+  for (size_t k = 0; k < corners.size(); k += stride)
   {
-#if NUM_THREADS > 1
-    thread_pool_->enqueue([this, corners, grid_map, normalizer_corner, &ws, i]() {
-#endif
-      // ------------------------------------------------------
-      // --- 3D corner map fitting
-      // ------------------------------------------------------
-      float w_corners = 0;
-      for (const auto& corner : corners)
-      {
-        // Convert feature to the map's referential frame
-        Point X = corner.pos_ * particles_[i].tf_;
+    const Corner& corner = corners[k];
 
-        // Check cell data
-        Cell* c = &(*grid_map)(X.x_, X.y_, X.z_);
-        if (c->data == nullptr)
-        {
-          continue;
-        }
-        std::vector<Corner>* l_corners = c->data->corner_features_;
-        if (l_corners == nullptr)
-        {
-          continue;
-        }
+    // Convert feature to the map's referential frame
+    Point X = corner.pos_ * particle.tf_;
 
-        // Search for a correspondence in the current cell first
-        Point best_correspondence_point;
-        float best_correspondence = 0.5;
-        bool found = false;
-        for (const auto& l_corner : *l_corners)
-        {
-          float dist_sq = ((X.x_ - l_corner.pos_.x_) * (X.x_ - l_corner.pos_.x_) +
-                           (X.y_ - l_corner.pos_.y_) * (X.y_ - l_corner.pos_.y_) +
-                           (X.z_ - l_corner.pos_.z_) * (X.z_ - l_corner.pos_.z_));
+    // Check cell data
+    Cell* c = &(*grid_map)(X.x_, X.y_, X.z_);
+    if (c->data == nullptr)
+    {
+      continue;
+    }
+    std::vector<Corner>* l_corners = c->data->corner_features_;
+    if (l_corners == nullptr)
+    {
+      continue;
+    }
 
-          if (dist_sq < best_correspondence)
-          {
-            best_correspondence_point = l_corner.pos_;
-            best_correspondence = dist_sq;
-            found = true;
-          }
-        }
+    // Search for a correspondence in the current cell first
+    Point best_correspondence_point;
+    float best_correspondence = 0.5;
+    bool found = false;
+    for (const auto& l_corner : *l_corners)
+    {
+      float dist_sq = ((X.x_ - l_corner.pos_.x_) * (X.x_ - l_corner.pos_.x_) +
+                       (X.y_ - l_corner.pos_.y_) * (X.y_ - l_corner.pos_.y_) +
+                       (X.z_ - l_corner.pos_.z_) * (X.z_ - l_corner.pos_.z_));
 
-        // Save distance if a correspondence was found
-        if (found)
-        {
-          w_corners +=
-              (normalizer_corner * static_cast<float>(std::exp(-1. / sigma_corner_matching_ * best_correspondence)));
-          // float l_w;
-          // updateModel(X.norm3D(), best_correspondence_point.norm3D(), best_correspondence, sigma_corner_matching_,
-          // 0.1, l_w);
-          // w_corners += l_w;
-        }
+      if (dist_sq < best_correspondence)
+      {
+        best_correspondence_point = l_corner.pos_;
+        best_correspondence = dist_sq;
+        found = true;
       }
+    }
 
-      ws[particles_[i].id_] = w_corners;
-#if NUM_THREADS > 1
-    });
-#endif
+    // Save distance if a correspondence was found
+    if (found)
+    {
+      w_corners +=
+          (normalizer_corner * static_cast<float>(std::exp(-1. / sigma_corner_matching_ * best_correspondence)));
+      // float l_w;
+      // updateModel(X.norm3D(), best_correspondence_point.norm3D(), best_correspondence, sigma_corner_matching_,
+      // 0.1, l_w);
+      // w_corners += l_w;
+    }
   }
 
-#if NUM_THREADS > 1
-  thread_pool_->wait();
-#endif
+  return w_corners;
 }
 
 void PF::mediumLevelPlanars(const std::vector<Planar>& planars, OccupancyMap* grid_map, std::vector<float>& ws)
+{
+  // Loop over all particles
+  forEachBlock([this, &planars, grid_map, &ws](const uint32_t&, const uint32_t& begin, const uint32_t& end) {
+    for (uint32_t i = begin; i < end; i++)
+      ws[particles_[i].id_] = planarWeight(particles_[i], planars, grid_map);
+  });
+}
+
+float PF::planarWeight(const Particle& particle, const std::vector<Planar>& planars, OccupancyMap* grid_map,
+                       const size_t& stride) const
 {
   float normalizer_planar = static_cast<float>(1.) / (sigma_planar_matching_ * std::sqrt(M_2PI));
 
-  // Loop over all particles
-  //  for (const auto& particle : particles_)
-  for (uint32_t i = 0; i < particles_size_; ++i)
+  // ------------------------------------------------------
+  // --- 3D planar map fitting
+  // ------------------------------------------------------
+  float w_planars = 0.;
+  for (size_t k = 0; k < planars.size(); k += stride)
   {
-#if NUM_THREADS > 1
-    thread_pool_->enqueue([this, planars, grid_map, normalizer_planar, &ws, i]() {
-#endif
-      // ------------------------------------------------------
-      // --- 3D planar map fitting
-      // ------------------------------------------------------
-      float w_planars = 0.;
-      for (const auto& planar : planars)
-      {
-        // Convert feature to the map's referential frame
-        Point X = planar.pos_ * particles_[i].tf_;
-
-        // Check cell data
-        Cell* c = &(*grid_map)(X.x_, X.y_, X.z_);
-        if (c->data == nullptr)
-        {
-          continue;
-        }
-        std::vector<Planar>* l_planars = c->data->planar_features_;
-        if (l_planars == nullptr)
-        {
-          continue;
-        }
+    const Planar& planar = planars[k];
 
-        // Search for a correspondence in the current cell first
-        Point best_correspondence_point;
-        float best_correspondence = 0.5;
-        bool found = false;
-        for (const auto& l_planar : *l_planars)
-        {
-          float dist_sq = ((X.x_ - l_planar.pos_.x_) * (X.x_ - l_planar.pos_.x_) +
-                           (X.y_ - l_planar.pos_.y_) * (X.y_ - l_planar.pos_.y_) +
-                           (X.z_ - l_planar.pos_.z_) * (X.z_ - l_planar.pos_.z_));
+    // Convert feature to the map's referential frame
+    Point X = planar.pos_ * particle.tf_;
 
-          if (dist_sq < best_correspondence)
-          {
-            best_correspondence_point = l_planar.pos_;
-            best_correspondence = dist_sq;
-            found = true;
-          }
-        }
+    // Check cell data
+    Cell* c = &(*grid_map)(X.x_, X.y_, X.z_);
+    if (c->data == nullptr)
+    {
+      continue;
+    }
+    std::vector<Planar>* l_planars = c->data->planar_features_;
+    if (l_planars == nullptr)
+    {
+      continue;
+    }
 
-        // Save distance if a correspondence was found
-        if (found)
-        {
-          w_planars +=
-              (normalizer_planar * static_cast<float>(std::exp((-1. / sigma_planar_matching_) * best_correspondence)));
+    // Search for a correspondence in the current cell first
+    Point best_correspondence_point;
+    float best_correspondence = 0.5;
+    bool found = false;
+    for (const auto& l_planar : *l_planars)
+    {
+      float dist_sq = ((X.x_ - l_planar.pos_.x_) * (X.x_ - l_planar.pos_.x_) +
+                       (X.y_ - l_planar.pos_.y_) * (X.y_ - l_planar.pos_.y_) +
+                       (X.z_ - l_planar.pos_.z_) * (X.z_ - l_planar.pos_.z_));
 
-          // float l_w;
-          // updateModel(X.norm3D(), best_correspondence_point.norm3D(), best_correspondence, sigma_planar_matching_,
-          // 0.1, l_w);
-          // w_planars += l_w;
-        }
+      if (dist_sq < best_correspondence)
+      {
+        best_correspondence_point = l_planar.pos_;
+        best_correspondence = dist_sq;
+        found = true;
       }
+    }
 
-      ws[particles_[i].id_] = w_planars;
-#if NUM_THREADS > 1
-    });
-#endif
+    // Save distance if a correspondence was found
+    if (found)
+    {
+      w_planars +=
+          (normalizer_planar * static_cast<float>(std::exp((-1. / sigma_planar_matching_) * best_correspondence)));
+
+      // float l_w;
+      // updateModel(X.norm3D(), best_correspondence_point.norm3D(), best_correspondence, sigma_planar_matching_,
+      // 0.1, l_w);
+      // w_planars += l_w;
+    }
   }
 
-#if NUM_THREADS > 1
-  thread_pool_->wait();
-#endif
+  return w_planars;
 }
 
 void PF::mediumLevelPlanes(const std::vector<SemiPlane>& planes, OccupancyMap* grid_map, std::vector<float>& ws)
+{
+  // Loop over all particles
+  forEachBlock([this, &planes, grid_map, &ws](const uint32_t&, const uint32_t& begin, const uint32_t& end) {
+    for (uint32_t i = begin; i < end; i++)
+      ws[particles_[i].id_] = planeWeight(particles_[i], planes, grid_map);
+  });
+}
+
+float PF::planeWeight(const Particle& particle, const std::vector<SemiPlane>& planes, OccupancyMap* grid_map) const
 {
   float normalizer_plane_vector = static_cast<float>(1.) / (sigma_plane_matching_vector_ * std::sqrt(M_2PI));
   float normalizer_plane_centroid = static_cast<float>(1.) / (sigma_plane_matching_centroid_ * std::sqrt(M_2PI));
 
-  // Loop over all particles
-  //  for (const auto& particle : particles_)
-  for (uint32_t i = 0; i < particles_size_; ++i)
+  float w_planes = 0.;
+  // ----------------------------------------------------------------------------
+  // ------ Search for correspondences between local planes and global planes
+  // ------ Three stage process:
+  // ------  * (A) Check semi-plane overlap
+  // ------  * (B) Compare planes normals
+  // ------  *  If (B), then check (C) plane to plane distance
+  // ----------------------------------------------------------------------------
+
+  // Define correspondence thresholds
+  float v_dist = 0.2;   // max vector displacement for all the components
+  float sp_dist = 0.2;  // max distance from source plane centroid to target plane
+  float area_th = 2.0;  // minimum overlapping area between semiplanes
+
+  // Correspondence result
+  float correspondence_vec;
+  float correspondence_centroid;
+
+  // Per thread scratch memory, reused so that the plane matching does not allocate after the first updates
+  thread_local std::vector<Point> l_extremas;
+  thread_local SemiPlane gg_plane;
+  thread_local SemiPlane lg_plane;
+  thread_local SemiPlane isct;
+
+  const std::array<float, 9>& Rot = particle.tf_.R_array_;
+  for (const auto& plane : planes)
   {
-#if NUM_THREADS > 1
-    thread_pool_->enqueue([this, planes, grid_map, normalizer_plane_vector, normalizer_plane_centroid, &ws, i]() {
-#endif
-      float w_planes = 0.;
-      // ----------------------------------------------------------------------------
-      // ------ Search for correspondences between local planes and global planes
-      // ------ Three stage process:
-      // ------  * (A) Check semi-plane overlap
-      // ------  * (B) Compare planes normals
-      // ------  *  If (B), then check (C) plane to plane distance
-      // ----------------------------------------------------------------------------
-
-      // Define correspondence thresholds
-      float v_dist = 0.2;   // max vector displacement for all the components
-      float sp_dist = 0.2;  // max distance from source plane centroid to target plane
-      float area_th = 2.0;  // minimum overlapping area between semiplanes
-
-      // Correspondence result
-      float correspondence_vec;
-      float correspondence_centroid;
-
-      for (const auto& plane : planes)
-      {
-        if (plane.points_.empty())
-        {
-          continue;
-        }
+    if (plane.points_.empty())
+    {
+      continue;
+    }
 
-        // Initialize correspondence deltas
-        float vec_disp = v_dist;
-        float point2plane = sp_dist;
-        float ov_area = area_th;
+    // Initialize correspondence deltas
+    float vec_disp = v_dist;
+    float point2plane = sp_dist;
+    float ov_area = area_th;
 
-        // Convert local plane to maps' referential frame
-        SemiPlane l_plane = plane;
-        for (auto& point : l_plane.points_)
-        {
-          point = point * particles_[i].tf_;  // Convert plane points
-        }
-        for (auto& point : l_plane.extremas_)
-        {
-          point = point * particles_[i].tf_;  // Convert plane boundaries
-        }
-        l_plane.centroid_ = l_plane.centroid_ * particles_[i].tf_;  // Convert the centroid
-        Ransac::estimateNormal(l_plane.points_, l_plane.a_, l_plane.b_, l_plane.c_,
-                               l_plane.d_);  // Convert plane normal
+    // Convert local plane to maps' referential frame
+    // - the normal is rotated directly, which gives the same result as re-estimating it from the transformed points
+    l_extremas.clear();
+    for (const auto& point : plane.extremas_)
+    {
+      l_extremas.push_back(point * particle.tf_);  // Convert plane boundaries
+    }
+    Point l_centroid = plane.centroid_ * particle.tf_;  // Convert the centroid
+    Vec u(Rot[0] * plane.a_ + Rot[1] * plane.b_ + Rot[2] * plane.c_,
+          Rot[3] * plane.a_ + Rot[4] * plane.b_ + Rot[5] * plane.c_,
+          Rot[6] * plane.a_ + Rot[7] * plane.b_ + Rot[8] * plane.c_);  // Convert plane normal
 
-        bool found = false;
-        for (auto& g_plane : grid_map->planes_)
-        {
-          if (g_plane.points_.empty())
-          {
-            continue;
-          }
+    bool found = false;
+    for (auto& g_plane : grid_map->planes_)
+    {
+      if (g_plane.points_.empty())
+      {
+        continue;
+      }
 
-          // --------------------------------
-          // (A) - Check semi-plane overlap
-          // --------------------------------
+      // --------------------------------
+      // (A) - Check semi-plane overlap
+      // --------------------------------
 
-          // First project the global and local plane extremas to the global plane reference frame
-          Tf ref_frame = g_plane.local_ref_.inverse();
-          SemiPlane gg_plane;
-          SemiPlane lg_plane;
-          for (const auto& extrema : g_plane.extremas_)
-          {
-            Point p = extrema * ref_frame;
-            p.z_ = 0;
-            gg_plane.extremas_.push_back(p);
-          }
-          for (const auto& extrema : l_plane.extremas_)
-          {
-            Point p = extrema * ref_frame;
-            p.z_ = 0;
-            lg_plane.extremas_.push_back(p);
-          }
+      // First project the global and local plane extremas to the global plane reference frame
+      Tf ref_frame = g_plane.local_ref_.inverse();
+      gg_plane.extremas_.clear();
+      lg_plane.extremas_.clear();
+      for (const auto& extrema : g_plane.extremas_)
+      {
+        Point p = extrema * ref_frame;
+        p.z_ = 0;
+        gg_plane.extremas_.push_back(p);
+      }
+      for (const auto& extrema : l_extremas)
+      {
+        Point p = extrema * ref_frame;
+        p.z_ = 0;
+        lg_plane.extremas_.push_back(p);
+      }
 
-          // Now, check for transformed polygon intersections
-          SemiPlane isct;
-          ConvexHull::polygonIntersection(gg_plane, lg_plane, isct.extremas_);
+      // Now, check for transformed polygon intersections
+      isct.extremas_.clear();
+      ConvexHull::polygonIntersection(gg_plane, lg_plane, isct.extremas_);
 
-          // Compute the intersection semi plane area
-          isct.setArea();
+      // Compute the intersection semi plane area
+      isct.setArea();
 
-          if (isct.area_ > ov_area)
-          {
-            // --------------------------------
-            // (B) - Compare plane normals
-            // --------------------------------
+      if (isct.area_ > ov_area)
+      {
+        // --------------------------------
+        // (B) - Compare plane normals
+        // --------------------------------
 
-            Vec u(l_plane.a_, l_plane.b_, l_plane.c_);
-            Vec v(g_plane.a_, g_plane.b_, g_plane.c_);
+        Vec v(g_plane.a_, g_plane.b_, g_plane.c_);
 
-            float D = ((u - v).norm3D() < (u + v).norm3D()) ? (u - v).norm3D() : (u + v).norm3D();
+        float D = ((u - v).norm3D() < (u + v).norm3D()) ? (u - v).norm3D() : (u + v).norm3D();
 
-            // Check if normal vectors match
-            if (D < vec_disp)
-            {
-              // --------------------------------
-              // (C) - Compute local plane centroid distance to global plane
-              // --------------------------------
-              float l_point2plane = g_plane.point2Plane(l_plane.centroid_);
-              if (l_point2plane < point2plane)
-              {
-                // We found a correspondence, so, we must save the correspondence deltas
-                vec_disp = D;
-                point2plane = l_point2plane;
-                ov_area = isct.area_;
+        // Check if normal vectors match
+        if (D < vec_disp)
+        {
+          // --------------------------------
+          // (C) - Compute local plane centroid distance to global plane
+          // --------------------------------
+          float l_point2plane = g_plane.point2Plane(l_centroid);
+          if (l_point2plane < point2plane)
+          {
+            // We found a correspondence, so, we must save the correspondence deltas
+            vec_disp = D;
+            point2plane = l_point2plane;
+            ov_area = isct.area_;
 
-                // Save correspondence errors
-                correspondence_vec = D;
-                correspondence_centroid = l_point2plane;
+            // Save correspondence errors
+            correspondence_vec = D;
+            correspondence_centroid = l_point2plane;
 
-                // Set correspondence flag
-                found = true;
-              }
-            }
+            // Set correspondence flag
+            found = true;
           }
         }
-
-        if (found)
-        {
-          w_planes +=
-              ((normalizer_plane_vector *
-                static_cast<float>(std::exp((-1. / sigma_plane_matching_vector_) * correspondence_vec))) *
-               (normalizer_plane_centroid *
-                static_cast<float>(std::exp((-1. / sigma_plane_matching_centroid_) * correspondence_centroid))));
-        }
       }
+    }
 
-      ws[particles_[i].id_] = w_planes;
-#if NUM_THREADS > 1
-    });
-#endif
+    if (found)
+    {
+      w_planes +=
+          ((normalizer_plane_vector *
+            static_cast<float>(std::exp((-1. / sigma_plane_matching_vector_) * correspondence_vec))) *
+           (normalizer_plane_centroid *
+            static_cast<float>(std::exp((-1. / sigma_plane_matching_centroid_) * correspondence_centroid))));
+    }
   }
 
-#if NUM_THREADS > 1
-  thread_pool_->wait();
-#endif
+  return w_planes;
 }
 
 void PF::normalizeWeights()
@@ -697,11 +1086,11 @@ void PF::resample()
   // - Compute the interval
   float interval = cweight / n;
   // - Compute the initial target weight
-  auto target = static_cast<float>(interval * ::drand48());
+  auto target = static_cast<float>(interval * rng_.uniform());
 
   // - Compute the resampled indexes
   cweight = 0.;
-  std::vector<uint32_t> indexes(n);
+  std::vector<uint32_t>& indexes = resample_idx_;
   n = 0.;
   uint32_t i = 0;
 
@@ -729,4 +1118,309 @@ void PF::resample()
   }
 }
 
+void PF::systematicResample()
+{
+  const uint32_t n = particles_size_;
+
+  // -------------------------------------------------------------------------------
+  // ----- Sum the weights of each block and compute the block offsets (exclusive scan)
+  // -------------------------------------------------------------------------------
+  forEachBlock([this](const uint32_t& t, const uint32_t& begin, const uint32_t& end) {
+    float sum = 0.;
+    for (uint32_t i = begin; i < end; i++)
+      sum += particles_[i].w_;
+    block_sum_[t + 1] = sum;
+  });
+  block_sum_[0] = 0.;
+  for (uint32_t t = 0; t < n_blocks_; t++)
+    block_sum_[t + 1] += block_sum_[t];
+
+  const float w_sum = block_sum_[n_blocks_];
+  if (w_sum <= 0.)
+  {
+    // Degenerate weights - keep the particles and reset the weights
+    for (auto& particle : particles_)
+      particle.w_ = static_cast<float>(1.) / static_cast<float>(n);
+    return;
+  }
+
+  // -------------------------------------------------------------------------------
+  // ----- Count the offspring of each particle and normalize its weight
+  // -------------------------------------------------------------------------------
+  // Systematic targets are (u0 + k) * interval, k = 0..n-1. The number of targets below a
+  // cumulative weight c is ceil(c / interval - u0), so each block can count its offspring alone.
+  const float interval = w_sum / static_cast<float>(n);
+  const float u0 = rng_.uniform();
+  auto n_targets = [n, interval, u0](const float& c) {
+    auto k = static_cast<int64_t>(std::ceil(c / interval - u0));
+    return static_cast<uint32_t>(std::min<int64_t>(std::max<int64_t>(k, 0), n));
+  };
+
+  forEachBlock([this, n, w_sum, &n_targets](const uint32_t& t, const uint32_t& begin, const uint32_t& end) {
+    uint32_t prev = n_targets(block_sum_[t]);
+    uint32_t last = (t == n_blocks_ - 1) ? n : n_targets(block_sum_[t + 1]);
+    float c = block_sum_[t];
+    uint32_t n_free = 0;
+    uint32_t n_extra = 0;
+
+    for (uint32_t i = begin; i < end; i++)
+    {
+      c += particles_[i].w_;
+      uint32_t cur = (i == end - 1) ? last : std::min(std::max(prev, n_targets(c)), last);
+
+      offspring_[i] = cur - prev;
+      n_free += (offspring_[i] == 0);
+      n_extra += (offspring_[i] > 1) ? offspring_[i] - 1 : 0;
+      prev = cur;
+
+      particles_[i].w_ /= w_sum;
+    }
+
+    block_free_[t + 1] = n_free;
+    block_extra_[t + 1] = n_extra;
+  });
+  block_free_[0] = 0;
+  block_extra_[0] = 0;
+  for (uint32_t t = 0; t < n_blocks_; t++)
+  {
+    block_free_[t + 1] += block_free_[t];
+    block_extra_[t + 1] += block_extra_[t];
+  }
+
+  // -------------------------------------------------------------------------------
+  // ----- Build the index permutation
+  // -------------------------------------------------------------------------------
+  // Every particle with offspring keeps its own slot, so it is never copied. Its extra
+  // copies go to the slots of the particles without offspring, matched by rank.
+  forEachBlock([this](const uint32_t& t, const uint32_t& begin, const uint32_t& end) {
+    uint32_t free_rank = block_free_[t];
+    uint32_t extra_rank = block_extra_[t];
+    for (uint32_t i = begin; i < end; i++)
+    {
+      if (offspring_[i] == 0)
+      {
+        free_slots_[free_rank++] = i;
+      }
+      for (uint32_t k = 1; k < offspring_[i]; k++)
+      {
+        extra_src_[extra_rank++] = i;
+      }
+    }
+  });
+
+  // -------------------------------------------------------------------------------
+  // ----- Gather - only the slots that change owner are written
+  // -------------------------------------------------------------------------------
+  const uint32_t n_copies = block_extra_[n_blocks_];
+  forEachBlock([this, n_copies](const uint32_t& t, const uint32_t&, const uint32_t&) {
+    uint32_t begin = (n_copies * t) / n_blocks_;
+    uint32_t end = (n_copies * (t + 1)) / n_blocks_;
+    for (uint32_t r = begin; r < end; r++)
+    {
+      const Particle& src = particles_[extra_src_[r]];
+      Particle& dst = particles_[free_slots_[r]];
+
+      dst.pp_ = src.pp_;
+      dst.ptf_ = src.ptf_;
+      dst.p_ = src.p_;
+      dst.tf_ = src.tf_;
+      dst.w_ = src.w_;
+      dst.which_cluster_ = src.which_cluster_;
+    }
+  });
+}
+
+bool PF::spawnWorkers(OccupancyMap* grid_map)
+{
+  if (params_.worker_processes_ <= 0 || !workers_.empty())
+  {
+    return false;
+  }
+  auto n_workers = static_cast<uint32_t>(params_.worker_processes_);
+
+  // Lay out the shared segment
+  // - [done | jobs | stop | n_corners | n_planars | tfs | corners | planars | corner weights | planar weights]
+  size_t offsets[10];
+  size_t size = 0;
+  auto reserve = [&size](const size_t& bytes, const size_t& alignment) {
+    size = (size + alignment - 1) / alignment * alignment;
+    size_t offset = size;
+    size += bytes;
+    return offset;
+  };
+  offsets[0] = reserve(sizeof(sem_t), alignof(sem_t));
+  offsets[1] = reserve(n_workers * sizeof(sem_t), alignof(sem_t));
+  offsets[2] = reserve(sizeof(bool), alignof(bool));
+  offsets[3] = reserve(sizeof(uint32_t), alignof(uint32_t));
+  offsets[4] = reserve(sizeof(uint32_t), alignof(uint32_t));
+  offsets[5] = reserve(particles_size_ * sizeof(Tf), alignof(Tf));
+  offsets[6] = reserve(MAX_SHARED_FEATURES * sizeof(Corner), alignof(Corner));
+  offsets[7] = reserve(MAX_SHARED_FEATURES * sizeof(Planar), alignof(Planar));
+  offsets[8] = reserve(particles_size_ * sizeof(float), alignof(float));
+  offsets[9] = reserve(particles_size_ * sizeof(float), alignof(float));
+
+  // The segment is an anonymous shared mapping, inherited by the forked workers
+  // - pages are only committed when touched, so the features capacity is cheap
+  void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (base == MAP_FAILED)
+  {
+    std::cout << "PF::spawnWorkers() --- failed to map the shared segment, scoring in-process.\n";
+    return false;
+  }
+
+  auto* bytes = static_cast<char*>(base);
+  segment_.base = base;
+  segment_.size = size;
+  segment_.done = reinterpret_cast<sem_t*>(bytes + offsets[0]);
+  segment_.jobs = reinterpret_cast<sem_t*>(bytes + offsets[1]);
+  segment_.stop = reinterpret_cast<bool*>(bytes + offsets[2]);
+  segment_.n_corners = reinterpret_cast<uint32_t*>(bytes + offsets[3]);
+  segment_.n_planars = reinterpret_cast<uint32_t*>(bytes + offsets[4]);
+  segment_.tfs = reinterpret_cast<Tf*>(bytes + offsets[5]);
+  segment_.corners = reinterpret_cast<Corner*>(bytes + offsets[6]);
+  segment_.planars = reinterpret_cast<Planar*>(bytes + offsets[7]);
+  segment_.corner_weights = reinterpret_cast<float*>(bytes + offsets[8]);
+  segment_.planar_weights = reinterpret_cast<float*>(bytes + offsets[9]);
+
+  sem_init(segment_.done, 1, 0);
+  for (uint32_t w = 0; w < n_workers; w++)
+    sem_init(&segment_.jobs[w], 1, 0);
+  *segment_.stop = false;
+
+  // Fork the workers
+  for (uint32_t w = 0; w < n_workers; w++)
+  {
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      workerLoop(w, grid_map);
+    }
+    else if (pid < 0)
+    {
+      std::cout << "PF::spawnWorkers() --- failed to fork a worker, scoring in-process.\n";
+      stopWorkers(true);
+      return false;
+    }
+    workers_.push_back(pid);
+  }
+
+  return true;
+}
+
+void PF::workerLoop(const uint32_t& w, OccupancyMap* grid_map)
+{
+  // Die with the parent process, and do not run its signal handlers
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+
+  auto n_workers = static_cast<uint32_t>(params_.worker_processes_);
+  uint32_t begin = (particles_size_ * w) / n_workers;
+  uint32_t end = (particles_size_ * (w + 1)) / n_workers;
+
+  std::vector<Corner> corners;
+  std::vector<Planar> planars;
+  corners.reserve(MAX_SHARED_FEATURES);
+  planars.reserve(MAX_SHARED_FEATURES);
+  Particle particle;
+
+  while (true)
+  {
+    while (sem_wait(&segment_.jobs[w]) != 0 && errno == EINTR)
+    {
+    }
+    if (*segment_.stop)
+    {
+      _exit(0);
+    }
+
+    corners.assign(segment_.corners, segment_.corners + *segment_.n_corners);
+    planars.assign(segment_.planars, segment_.planars + *segment_.n_planars);
+    for (uint32_t i = begin; i < end; i++)
+    {
+      particle.tf_ = segment_.tfs[i];
+      segment_.corner_weights[i] = cornerWeight(particle, corners, grid_map);
+      segment_.planar_weights[i] = planarWeight(particle, planars, grid_map);
+    }
+
+    sem_post(segment_.done);
+  }
+}
+
+bool PF::scoreInWorkers(const std::vector<Corner>& corners, const std::vector<Planar>& planars,
+                        std::vector<float>& corner_ws, std::vector<float>& planar_ws)
+{
+  if (workers_.empty() || corners.size() > MAX_SHARED_FEATURES || planars.size() > MAX_SHARED_FEATURES)
+  {
+    return false;
+  }
+
+  // Publish the batch
+  for (uint32_t i = 0; i < particles_size_; i++)
+    segment_.tfs[i] = particles_[i].tf_;
+  std::copy(corners.begin(), corners.end(), segment_.corners);
+  std::copy(planars.begin(), planars.end(), segment_.planars);
+  *segment_.n_corners = static_cast<uint32_t>(corners.size());
+  *segment_.n_planars = static_cast<uint32_t>(planars.size());
+  for (size_t w = 0; w < workers_.size(); w++)
+    sem_post(&segment_.jobs[w]);
+
+  // Wait for all the workers to score their share of the particles
+  // - the timeout is on the monotonic clock, so that a wall clock step (NTP, GPS time) does not shorten or stretch it
+  timespec timeout{};
+  clock_gettime(CLOCK_MONOTONIC, &timeout);
+  timeout.tv_sec += WORKERS_TIMEOUT;
+  for (size_t w = 0; w < workers_.size(); w++)
+  {
+    int rc;
+    while ((rc = sem_clockwait(segment_.done, CLOCK_MONOTONIC, &timeout)) != 0 && errno == EINTR)
+    {
+    }
+    if (rc != 0)
+    {
+      // A worker died or stalled - do not rely on them anymore
+      std::cout << "PF::scoreInWorkers() --- the scoring workers did not answer, scoring in-process.\n";
+      stopWorkers(true);
+      return false;
+    }
+  }
+
+  for (uint32_t i = 0; i < particles_size_; i++)
+  {
+    corner_ws[particles_[i].id_] = segment_.corner_weights[i];
+    planar_ws[particles_[i].id_] = segment_.planar_weights[i];
+  }
+
+  return true;
+}
+
+void PF::stopWorkers(const bool& force)
+{
+  if (segment_.base == nullptr)
+  {
+    return;
+  }
+
+  if (force)
+  {
+    for (const auto& pid : workers_)
+      kill(pid, SIGKILL);
+  }
+  else
+  {
+    *segment_.stop = true;
+    for (size_t w = 0; w < workers_.size(); w++)
+      sem_post(&segment_.jobs[w]);
+  }
+  for (const auto& pid : workers_)
+    waitpid(pid, nullptr, 0);
+  workers_.clear();
+
+  sem_destroy(segment_.done);
+  for (auto w = 0; w < params_.worker_processes_; w++)
+    sem_destroy(&segment_.jobs[w]);
+  munmap(segment_.base, segment_.size);
+  segment_ = ScoringSegment();
+}
+
 }  // namespace vineslam
@@ -54,6 +54,25 @@ bool ElevationMap::update(const float& z, const float& i, const float& j)
   return update(z, l_i, l_j);
 }
 
+bool ElevationMap::getElevation(const float& x, const float& y, float& z) const
+{
+  // Same indexing as operator(), without the exception on out of bounds accesses
+  // .49 is to prevent bad approximations (e.g. 1.49 = 1 & 1.51 = 2)
+  int i = static_cast<int>(std::round(x / resolution_ + .49));
+  int j = static_cast<int>(std::round(y / resolution_ + .49));
+  int l_i = i - static_cast<int>(std::round(origin_.x_ / resolution_ + .49));
+  int l_j = j - static_cast<int>(std::round(origin_.y_ / resolution_ + .49));
+  int idx = l_i + l_j * static_cast<int>(std::round(width_ / resolution_ + .49));
+
+  if (idx >= static_cast<int>(cell_vec_.size()) - 1 || idx < 0 || cell_vec_[idx] == 0)
+  {
+    return false;
+  }
+
+  z = cell_vec_[idx];
+  return true;
+}
+
 void ElevationMap::color(float z, float& r, float&g, float& b)
 {
   // blend over HSV-values (more colors)
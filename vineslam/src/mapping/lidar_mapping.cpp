@@ -8,6 +8,31 @@ LidarMapper::LidarMapper()
   it_ = 0;
 }
 
+LidarMapper* LidarMapper::create(const std::string& sensor, const Parameters& params)
+{
+  if (sensor == "velodyne")
+  {
+    return new VelodyneMapper(params);
+  }
+  else if (sensor == "livox")
+  {
+    return new LivoxMapper(params);
+  }
+
+  return nullptr;
+}
+
+const std::vector<Point>& LidarMapper::voxelFilter(const std::vector<Point>& pcl)
+{
+  if (!voxel_grid_.enabled())
+  {
+    return pcl;
+  }
+
+  voxel_grid_.process(pcl, voxel_pcl_, voxel_idx_);
+  return voxel_pcl_;
+}
+
 void LidarMapper::registerMaps(const Pose& robot_pose, const std::vector<Corner>& corners,
                                const std::vector<Planar>& planars, const std::vector<SemiPlane>& planes,
                                const SemiPlane& ground, OccupancyMap& grid_map, ElevationMap& elevation_map)
@@ -23,7 +48,10 @@ void LidarMapper::registerMaps(const Pose& robot_pose, const std::vector<Corner>
   globalElevationMap(robot_pose, ground, elevation_map);
 
   // Store robot pose to use in the next iteration
-  prev_robot_pose_ = robot_pose;
+  {
+    std::lock_guard<std::mutex> lock(prev_robot_pose_mutex_);
+    prev_robot_pose_ = robot_pose;
+  }
 
   // Increment mapper iterator
   it_++;
@@ -42,7 +70,10 @@ void LidarMapper::registerMaps(const Pose& robot_pose, const std::vector<Corner>
   globalPlaneMap(robot_pose, { ground }, grid_map);
 
   // Store robot pose to use in the next iteration
-  prev_robot_pose_ = robot_pose;
+  {
+    std::lock_guard<std::mutex> lock(prev_robot_pose_mutex_);
+    prev_robot_pose_ = robot_pose;
+  }
 
   // Increment mapper iterator
   it_++;
@@ -556,7 +587,7 @@ void LidarMapper::filterWithinZone(const Pose& robot_pose, const std::vector<Poi
 // ----- Velodyne functions
 // -------------------------------------------------------------------
 
-VelodyneMapper::VelodyneMapper(const Parameters& params)
+VelodyneMapper::VelodyneMapper(const Parameters& params) : model_(params.lidar_model_)
 {
   // Set velodyne configuration parameters
   picked_num_ = 2;
@@ -569,17 +600,51 @@ VelodyneMapper::VelodyneMapper(const Parameters& params)
     planes_th_ = static_cast<float>(60.) * DEGREE_TO_RAD;
   }
   ground_th_ = static_cast<float>(3.) * DEGREE_TO_RAD;
+  tan2_ground_th_ = std::tan(ground_th_) * std::tan(ground_th_);
   edge_threshold_ = 0.1;
   planar_threshold_ = 0.1;
-  vertical_scans_ = 16;
-  horizontal_scans_ = 1800;
-  ground_scan_idx_ = 7;
   segment_valid_point_num_ = 5;
   segment_valid_line_num_ = 3;
-  vertical_angle_bottom_ = static_cast<float>(15. + 0.1) * DEGREE_TO_RAD;
-  ang_res_x_ = static_cast<float>(0.2) * DEGREE_TO_RAD;
-  ang_res_y_ = static_cast<float>(2.) * DEGREE_TO_RAD;
-  lidar_height_ = 1.20;
+
+  // Set the sensor geometry
+  vertical_scans_ = model_.vertical_scans_;
+  horizontal_scans_ = model_.horizontal_scans_;
+  ground_scan_idx_ = model_.ground_scan_idx_;
+  ang_res_x_ = model_.ang_res_x_;
+  lidar_height_ = params.lidar_height_;
+
+  // Set the voxel grid prefilter
+  voxel_grid_ = VoxelGrid(params.lidar_voxel_size_, params.lidar_voxel_centroid_);
+
+  // Size the per scan workspace once
+  n_threads_ = Threads::count(params.num_threads_, params.reserved_cores_, params.thread_pools_,
+                              params.thread_pool_idx_);
+  allocate();
+
+  // Set the segmentation method and its neighbour link constants
+  union_find_ = (params.lidar_segmentation_ == "union_find");
+  segment_planes_ = (params.lidar_plane_extraction_ == "segments");
+  sin_planes_th_ = std::sin(planes_th_);
+  horizontal_link_ = std::sin(ang_res_x_ + planes_th_);
+  vertical_links_.resize(vertical_scans_);
+  for (int i = 1; i < vertical_scans_; i++)
+    vertical_links_[i] = std::sin(model_.ringGap(i - 1, i) + planes_th_);
+
+  // Initialize thread pool
+  // - with a single thread, no workers are launched and the tasks run in the calling thread
+  thread_pool_ = new lama::ThreadPool;
+  if (n_threads_ > 1)
+  {
+    thread_pool_->init(n_threads_);
+
+    if (params.pin_threads_)
+    {
+      std::vector<int> cores =
+          Threads::pinningCores(params.reserved_cores_, params.thread_pools_, params.thread_pool_idx_);
+      for (size_t i = 0; i < thread_pool_->workers.size(); i++)
+        Threads::pin(thread_pool_->workers[i], cores[i % cores.size()]);
+    }
+  }
 
   // Set robot dimensions for elevation map computation
   robot_dim_x_ = params.robot_dim_x_;
@@ -590,130 +655,180 @@ VelodyneMapper::VelodyneMapper(const Parameters& params)
   prev_robot_pose_ = Pose(0, 0, 0, 0, 0, 0);
 }
 
-void VelodyneMapper::flatGroundRemoval(const std::vector<Point>& in_pts, Plane& out_pcl)
+VelodyneMapper::~VelodyneMapper()
+{
+  delete thread_pool_;
+}
+
+void VelodyneMapper::groundSegmentation(const std::vector<Point>& in_pts, Plane& out_pcl,
+                                       std::vector<PlaneMoments>& out_hypotheses)
 {
   // _ground_mat
   // -1, no valid info to check if ground of not
   //  0, initial value, after validation, means not ground
   //  1, ground
-  for (int j = 0; j < horizontal_scans_; j++)
-  {
-    for (int i = 0; i < ground_scan_idx_; i++)
-    {
-      int lower_idx = j + i * horizontal_scans_;
-      int upper_idx = j + (i + 1) * horizontal_scans_;
-
-      Point upper_pt = in_pts[upper_idx];
-      Point lower_pt = in_pts[lower_idx];
+  // - the columns are processed in blocks, in parallel, each block with its own candidates and moments
+  float min_abs_z = lidar_height_ / 2;
+  forEachBlock(horizontal_scans_, [&](const int& t, const int& begin, const int& end) {
+    std::vector<Point>& candidates = block_ground_[t];
+    std::vector<PlaneMoments>& moments = block_moments_[t];
+    candidates.clear();
+    std::fill(moments.begin(), moments.end(), PlaneMoments());
 
-      if (range_mat_(i, j) == -1 || range_mat_(i + 1, j) == -1)
+    for (int j = begin; j < end; j++)
+    {
+      for (int i = 0; i < ground_scan_idx_; i++)
       {
-        // no info to check, invalid points
-        //        ground_mat_(i, j) = -1;
-        continue;
-      }
+        if (range_mat_(i, j) == -1 || range_mat_(i + 1, j) == -1)
+        {
+          // no info to check, invalid points
+          continue;
+        }
 
-      float dX = upper_pt.x_ - lower_pt.x_;
-      float dY = upper_pt.y_ - lower_pt.y_;
-      float dZ = upper_pt.z_ - lower_pt.z_;
+        const Point& lower_pt = in_pts[j + i * horizontal_scans_];
+        const Point& upper_pt = in_pts[j + (i + 1) * horizontal_scans_];
 
-      float vertical_angle = std::atan2(dZ, std::sqrt(dX * dX + dY * dY + dZ * dZ));
+        // The pair is ground if the segment between them rises less than ground_th, that is, if
+        // atan2(dZ, |d|) <= ground_th, which is tested without trigonometry
+        float dX = upper_pt.x_ - lower_pt.x_;
+        float dY = upper_pt.y_ - lower_pt.y_;
+        float dZ = upper_pt.z_ - lower_pt.z_;
+        if (dZ > 0 && dZ * dZ > tan2_ground_th_ * (dX * dX + dY * dY + dZ * dZ))
+        {
+          continue;
+        }
 
-      if (vertical_angle <= ground_th_ && std::fabs(lower_pt.z_) > lidar_height_ / 2 &&
-          std::fabs(upper_pt.z_) > lidar_height_ / 2)
-      {
-        out_pcl.points_.push_back(lower_pt);
-        out_pcl.points_.push_back(upper_pt);
-        out_pcl.indexes_.emplace_back(i, j);
-        out_pcl.indexes_.emplace_back(i + 1, j);
+        // Mark raw ground points
+        ground_mat_(i, j) = 1;
+        ground_mat_(i + 1, j) = 1;
+        label_mat_(i, j) = -1;
+        label_mat_(i + 1, j) = -1;
+
+        // Ground plane candidates: the points of pairs more than half the sensor height away from its horizontal
+        // plane, closer than 5 meters
+        // - the moments of the candidates under the sensor are binned by height
+        if (std::fabs(lower_pt.z_) > min_abs_z && std::fabs(upper_pt.z_) > min_abs_z)
+        {
+          for (const auto* pt : { &lower_pt, &upper_pt })
+          {
+            if (pt->x_ * pt->x_ + pt->y_ * pt->y_ + pt->z_ * pt->z_ < 25.)
+            {
+              candidates.push_back(*pt);
+
+              auto bin = static_cast<int>(-pt->z_ / ground_bin_size_);
+              if (pt->z_ < 0. && bin < static_cast<int>(moments.size()))
+                moments[bin].add(*pt);
+            }
+          }
+        }
       }
     }
-  }
-}
+  });
 
-void VelodyneMapper::groundRemoval(const std::vector<Point>& in_pts, Plane& out_pcl)
-{
-  // _ground_mat
-  // -1, no valid info to check if ground of not
-  //  0, initial value, after validation, means not ground
-  //  1, ground
-  for (int j = 0; j < horizontal_scans_; j++)
+  std::vector<PlaneMoments>& bins = ground_bins_;
+  std::fill(bins.begin(), bins.end(), PlaneMoments());
+  out_pcl.points_.clear();
+  for (uint32_t t = 0; t < n_threads_; t++)
   {
-    for (int i = 0; i < ground_scan_idx_; i++)
-    {
-      int lower_idx = j + i * horizontal_scans_;
-      int upper_idx = j + (i + 1) * horizontal_scans_;
-
-      Point upper_pt = in_pts[upper_idx];
-      Point lower_pt = in_pts[lower_idx];
-
-      if (range_mat_(i, j) == -1 || range_mat_(i + 1, j) == -1)
-      {
-        // no info to check, invalid points
-        //        ground_mat_(i, j) = -1;
-        continue;
-      }
+    out_pcl.points_.insert(out_pcl.points_.end(), block_ground_[t].begin(), block_ground_[t].end());
+    for (size_t k = 0; k < bins.size(); k++)
+      bins[k] += block_moments_[t][k];
+  }
 
-      float dX = upper_pt.x_ - lower_pt.x_;
-      float dY = upper_pt.y_ - lower_pt.y_;
-      float dZ = upper_pt.z_ - lower_pt.z_;
+  // The ground plane hypotheses are the candidates of the most populated slabs of three height bins, so that each
+  // one is not biased by the surfaces at other heights, as the top of the vegetation
+  // - the ground may be tilted, but the points in a slab of a plane still lie on it
+  std::vector<PlaneMoments>& slabs = ground_slabs_;
+  for (size_t k = 0; k < bins.size(); k++)
+  {
+    slabs[k] = bins[k];
+    if (k > 0)
+      slabs[k] += bins[k - 1];
+    if (k + 1 < bins.size())
+      slabs[k] += bins[k + 1];
+  }
 
-      float vertical_angle = std::atan2(dZ, std::sqrt(dX * dX + dY * dY + dZ * dZ));
+  out_hypotheses.clear();
+  for (int h = 0; h < GROUND_HYPOTHESES; h++)
+  {
+    auto best = std::max_element(slabs.begin(), slabs.end(), [](const PlaneMoments& a, const PlaneMoments& b) {
+      return a.n_ < b.n_;
+    });
+    if (best == slabs.end() || best->n_ < 3)
+      break;
+    out_hypotheses.push_back(*best);
 
-      if (vertical_angle <= ground_th_)
-      {
-        out_pcl.points_.push_back(lower_pt);
-        out_pcl.points_.push_back(upper_pt);
-        out_pcl.indexes_.emplace_back(i, j);
-        out_pcl.indexes_.emplace_back(i + 1, j);
-      }
-    }
+    // The next hypothesis can not overlap this one
+    auto k = static_cast<int>(best - slabs.begin());
+    for (int l = std::max(k - 2, 0); l <= std::min(k + 2, static_cast<int>(slabs.size()) - 1); l++)
+      slabs[l] = PlaneMoments();
   }
 }
 
 void VelodyneMapper::cloudSegmentation(const std::vector<Point>& in_pts, std::vector<PlanePoint>& cloud_seg)
 {
+  cloud_seg.clear();
+
   // Segmentation process
-  int label = 1;
-  for (int i = 0; i < vertical_scans_; i++)
+  if (union_find_)
   {
-    for (int j = 0; j < horizontal_scans_; j++)
+    labelComponentsUnionFind();
+  }
+  else
+  {
+    int label = 1;
+    for (int i = 0; i < vertical_scans_; i++)
     {
-      if (label_mat_(i, j) == 0 && range_mat_(i, j) != -1)
-        labelComponents(i, j, label);
+      for (int j = 0; j < horizontal_scans_; j++)
+      {
+        if (label_mat_(i, j) == 0 && range_mat_(i, j) != -1)
+          labelComponents(i, j, label);
+      }
     }
+    n_segments_ = label - 1;
   }
 
   // Extract segmented cloud for visualization
-  int seg_cloud_size = 0;
-  for (int i = 0; i < vertical_scans_; i++)
-  {
-    seg_pcl_.start_col_idx[i] = seg_cloud_size - 1 + 5;
+  // - the points kept in each ring are counted first, so that the rings are then copied in parallel, each one from
+  //   its offset in the segmented cloud
+  auto keep = [this](const int& i, const int& j) {
+    if (!(label_mat_(i, j) > 0 || ground_mat_(i, j) == 1) || label_mat_(i, j) == 999999)
+      return false;
 
-    for (int j = 0; j < horizontal_scans_; j++)
+    // The majority of ground points are skipped
+    return ground_mat_(i, j) != 1 || !(j % 5 != 0 && j > 5 && j < horizontal_scans_ - 5);
+  };
+
+  std::vector<int>& ring_offset = ring_offset_;
+  forEachBlock(vertical_scans_, [&](const int&, const int& begin, const int& end) {
+    for (int i = begin; i < end; i++)
     {
-      if (label_mat_(i, j) > 0 || ground_mat_(i, j) == 1)
+      int ring_size = 0;
+      for (int j = 0; j < horizontal_scans_; j++)
+        ring_size += keep(i, j) ? 1 : 0;
+      ring_offset[i + 1] = ring_size;
+    }
+  });
+  ring_offset[0] = 0;
+  std::partial_sum(ring_offset.begin(), ring_offset.end(), ring_offset.begin());
+  cloud_seg.resize(ring_offset[vertical_scans_]);
+
+  forEachBlock(vertical_scans_, [&](const int&, const int& begin, const int& end) {
+    for (int i = begin; i < end; i++)
+    {
+      int seg_cloud_size = ring_offset[i];
+      seg_pcl_.start_col_idx[i] = seg_cloud_size - 1 + 5;
+
+      for (int j = 0; j < horizontal_scans_; j++)
       {
-        if (label_mat_(i, j) == 999999)
+        if (!keep(i, j))
           continue;
 
-        // The majority of ground points are skipped
-        if (ground_mat_(i, j) == 1)
-        {
-          //          if (j % 20 != 0 && j > 20 && j < horizontal_scans_ - 20)
-          if (j % 5 != 0 && j > 5 && j < horizontal_scans_ - 5)
-          {
-            continue;
-          }
-        }
-
         // Mark ground points so they will not be considered as edge features later
         seg_pcl_.is_ground[seg_cloud_size] = (ground_mat_(i, j) == 1);
 
         // Save segmented cloud into a pcl
-        Point pt = in_pts[j + i * horizontal_scans_];
-        PlanePoint plane_pt(pt, label_mat_(i, j));
-        cloud_seg.push_back(plane_pt);
+        cloud_seg[seg_cloud_size] = PlanePoint(in_pts[j + i * horizontal_scans_], label_mat_(i, j));
         // ------------------------------------------
         // Save segmented cloud in the given structure
         seg_pcl_.col_idx[seg_cloud_size] = j;
@@ -721,30 +836,29 @@ void VelodyneMapper::cloudSegmentation(const std::vector<Point>& in_pts, std::ve
         seg_cloud_size++;
         // ------------------------------------------
       }
+      seg_pcl_.end_col_idx[i] = seg_cloud_size - 1 - 5;
     }
-    seg_pcl_.end_col_idx[i] = seg_cloud_size - 1 - 5;
-  }
+  });
 }
 
 void VelodyneMapper::labelComponents(const int& row, const int& col, int& label)
 {
-  using Coord2D = Eigen::Vector2i;
-  std::deque<Coord2D> queue;
-  std::deque<Coord2D> global_queue;
-
+  // The queue keeps all the pixels pushed, so that it also holds the whole segment at the end
+  std::vector<Coord2D>& queue = segment_queue_;
+  queue.clear();
   queue.emplace_back(row, col);
-  global_queue.emplace_back(row, col);
+  size_t queue_front = 0;
 
-  std::vector<bool> line_count_flag(vertical_scans_, false);
+  std::vector<uint8_t>& line_count_flag = line_count_flag_;
+  std::fill(line_count_flag.begin(), line_count_flag.end(), 0);
 
   // - Define neighborhood
   const Coord2D neighbor_it[4] = { { 0, -1 }, { -1, 0 }, { 1, 0 }, { 0, 1 } };
 
-  while (!queue.empty())
+  while (queue_front < queue.size())
   {
     // Evaluate front element of the queue and pop it
-    Coord2D from_idx = queue.front();
-    queue.pop_front();
+    Coord2D from_idx = queue[queue_front++];
 
     // Mark popped point as belonging to the segment
     label_mat_(from_idx.x(), from_idx.y()) = label;
@@ -778,14 +892,13 @@ void VelodyneMapper::labelComponents(const int& row, const int& col, int& label)
       float dmin = std::min(d1, d2);
 
       // Compute angle between the two points
-      float alpha = (iter.x() == 0) ? ang_res_x_ : ang_res_y_;
+      float alpha = (iter.x() == 0) ? ang_res_x_ : model_.ringGap(from_idx.x(), c_idx_x);
 
       // Compute beta and check if points belong to the same segment
       auto beta = std::atan2((dmin * std::sin(alpha)), (dmax - dmin * std::cos(alpha)));
       if (beta > planes_th_)
       {
         queue.emplace_back(c_idx_x, c_idx_y);
-        global_queue.emplace_back(c_idx_x, c_idx_y);
 
         label_mat_(c_idx_x, c_idx_y) = label;
         line_count_flag[c_idx_x] = true;
@@ -795,11 +908,11 @@ void VelodyneMapper::labelComponents(const int& row, const int& col, int& label)
 
   // Check if this segment is valid
   bool feasible_segment = false;
-  if (global_queue.size() >= 30)
+  if (queue.size() >= 30)
   {
     feasible_segment = true;
   }
-  else if (static_cast<int>(global_queue.size()) >= segment_valid_point_num_)
+  else if (static_cast<int>(queue.size()) >= segment_valid_point_num_)
   {
     int line_count = 0;
     for (int i = 0; i < vertical_scans_; i++)
@@ -818,21 +931,190 @@ void VelodyneMapper::labelComponents(const int& row, const int& col, int& label)
   }
   else
   {
-    for (auto& i : global_queue)
+    for (auto& i : queue)
       label_mat_(i.x(), i.y()) = 999999;
   }
 }
 
+int VelodyneMapper::findRoot(int idx)
+{
+  // Path halving
+  while (parent_[idx] != idx)
+  {
+    parent_[idx] = parent_[parent_[idx]];
+    idx = parent_[idx];
+  }
+
+  return idx;
+}
+
+void VelodyneMapper::join(const int& a, const int& b)
+{
+  int root_a = findRoot(a);
+  int root_b = findRoot(b);
+
+  // The smallest index is kept as root
+  if (root_a < root_b)
+    parent_[root_b] = root_a;
+  else if (root_b < root_a)
+    parent_[root_a] = root_b;
+}
+
+void VelodyneMapper::labelComponentsUnionFind()
+{
+  // Pixels that can be segmented point to themselves, and the others are marked with -1
+  for (int i = 0; i < vertical_scans_; i++)
+  {
+    for (int j = 0; j < horizontal_scans_; j++)
+    {
+      int idx = j + i * horizontal_scans_;
+      parent_[idx] = (label_mat_(i, j) == 0 && range_mat_(i, j) != -1) ? idx : -1;
+    }
+  }
+
+  // Join the neighbours of each strip of columns
+  // - each strip only touches its own pixels, so the strips are independent
+  forEachBlock(horizontal_scans_, [this](const int&, const int& begin, const int& end) {
+    for (int j = begin; j < end; j++)
+    {
+      for (int i = 0; i < vertical_scans_; i++)
+      {
+        int idx = j + i * horizontal_scans_;
+        if (parent_[idx] == -1)
+          continue;
+
+        float d = range_mat_(i, j);
+        if (j > begin && parent_[idx - 1] != -1 && linked(d, range_mat_(i, j - 1), horizontal_link_))
+          join(idx, idx - 1);
+        if (i > 0 && parent_[idx - horizontal_scans_] != -1 && linked(d, range_mat_(i - 1, j), vertical_links_[i]))
+          join(idx, idx - horizontal_scans_);
+      }
+    }
+  });
+
+  // Merge the strips at their borders, including the one where the image wraps around
+  auto n_strips = static_cast<int>(n_threads_);
+  for (int s = 0; s < n_strips; s++)
+  {
+    int j = (horizontal_scans_ * s) / n_strips;
+    int prev_j = (j == 0) ? horizontal_scans_ - 1 : j - 1;
+    for (int i = 0; i < vertical_scans_; i++)
+    {
+      int idx = j + i * horizontal_scans_;
+      int prev_idx = prev_j + i * horizontal_scans_;
+      if (parent_[idx] != -1 && parent_[prev_idx] != -1 &&
+          linked(range_mat_(i, j), range_mat_(i, prev_j), horizontal_link_))
+        join(idx, prev_idx);
+    }
+  }
+
+  // Gather the size and the rows of each segment
+  // - the pixels are visited in row-major order, so the root of each segment comes first
+  // - the rows are counted as in labelComponents, where the seed row only counts if the segment has another pixel
+  //   in it
+  for (int i = 0; i < vertical_scans_; i++)
+  {
+    for (int j = 0; j < horizontal_scans_; j++)
+    {
+      int idx = j + i * horizontal_scans_;
+      if (parent_[idx] == -1)
+        continue;
+
+      int root = findRoot(idx);
+      parent_[idx] = root;
+
+      SegmentStats& stats = segment_stats_[root];
+      if (root == idx)
+      {
+        stats = SegmentStats{ 1, 1, i, 1, 0 };
+        continue;
+      }
+
+      stats.size++;
+      if (i == stats.last_row)
+      {
+        stats.seed_row_pixels += (i == root / horizontal_scans_) ? 1 : 0;
+      }
+      else
+      {
+        stats.rows++;
+        stats.last_row = i;
+      }
+    }
+  }
+
+  // Label the segments by the order of their root, discarding the unfeasible ones
+  int label = 1;
+  for (int i = 0; i < vertical_scans_; i++)
+  {
+    for (int j = 0; j < horizontal_scans_; j++)
+    {
+      int idx = j + i * horizontal_scans_;
+      if (parent_[idx] == -1)
+        continue;
+
+      SegmentStats& stats = segment_stats_[parent_[idx]];
+      if (parent_[idx] == idx)
+      {
+        int line_count = stats.rows - ((stats.seed_row_pixels == 1) ? 1 : 0);
+        bool feasible_segment = stats.size >= 30 || (stats.size >= segment_valid_point_num_ &&
+                                                     line_count >= segment_valid_line_num_);
+        stats.label = feasible_segment ? label++ : 999999;
+      }
+
+      label_mat_(i, j) = stats.label;
+    }
+  }
+  n_segments_ = label - 1;
+}
+
 void VelodyneMapper::extractHighLevelPlanes(const std::vector<Point>& in_pts, const SemiPlane& ground_plane,
                                             std::vector<SemiPlane>& out_planes)
 {
   Tf tf;
   std::array<float, 9> tf_rot{};
-  prev_robot_pose_.toRotMatrix(tf_rot);
+  prevRobotPose().toRotMatrix(tf_rot);
   tf = Tf(tf_rot, std::array<float, 3>{ 0, 0, 0 });
 
+  std::vector<Plane> planes = {};
+  if (segment_planes_)
+  {
+    segmentSidePlanes(ground_plane, tf, planes);
+  }
+  else
+  {
+    ransacSidePlanes(in_pts, ground_plane, tf, planes);
+  }
+
+  // -------------------------------------------------------------------------------
+  // ----- Check the validity of the extracted planes
+  // -------------------------------------------------------------------------------
+  for (auto& plane : planes)
+  {
+    // Check if the plane have a minimum number of points
+    plane.centroid_ = Point(0, 0, 0);
+    for (const auto& pt : plane.points_)
+    {
+      plane.centroid_ = plane.centroid_ + pt;
+    }
+    plane.centroid_ = plane.centroid_ / static_cast<float>(plane.points_.size());
+    plane.setLocalRefFrame();
+
+    SemiPlane l_semi_plane;
+    bool ch = ConvexHull::process(plane, l_semi_plane);
+    if (ch && checkPlaneConsistency(l_semi_plane, ground_plane))
+    {
+      out_planes.push_back(l_semi_plane);
+    }
+  }
+}
+
+void VelodyneMapper::ransacSidePlanes(const std::vector<Point>& in_pts, const SemiPlane& ground_plane, const Tf& tf,
+                                      std::vector<Plane>& planes)
+{
   // Remove ground and null points from the set of input points
-  std::vector<Point> non_ground{};
+  std::vector<Point>& non_ground = non_ground_;
+  non_ground.clear();
   for (const auto& pt : in_pts)
   {
     if (ground_plane.point2Plane(pt) > 0.2 && pt != Point(0, 0, 0))
@@ -851,7 +1133,10 @@ void VelodyneMapper::extractHighLevelPlanes(const std::vector<Point>& in_pts, co
   y_mean /= static_cast<float>(non_ground.size());
 
   // - Cluster points using the y mean threshold
-  Plane side_plane_a, side_plane_b;
+  Plane& side_plane_a = side_planes_[0];
+  Plane& side_plane_b = side_planes_[1];
+  side_plane_a.points_.clear();
+  side_plane_b.points_.clear();
   for (auto const& plane_pt : non_ground)
   {
     Point rotated_to_map_pt = plane_pt * tf;
@@ -871,42 +1156,124 @@ void VelodyneMapper::extractHighLevelPlanes(const std::vector<Point>& in_pts, co
   }
 
   // - Remove outliers using RANSAC
-  std::vector<Plane> planes = {};
   Plane side_plane_a_filtered, side_plane_b_filtered;
-  if (Ransac::process(side_plane_a.points_, side_plane_a_filtered, 300, 0.10, true) &&
+  if (Ransac::processAdaptive(side_plane_a.points_, side_plane_a_filtered, 300, 0.10, true) &&
       side_plane_a_filtered.points_.size() < 7000 &&
       side_plane_a_filtered.points_.size() > 75)  // prevent dense planes and slow convex hulls
   {
     side_plane_a_filtered.id_ = 0;
     planes.push_back(side_plane_a_filtered);
   }
-  if (Ransac::process(side_plane_b.points_, side_plane_b_filtered, 300, 0.10, true) &&
+  if (Ransac::processAdaptive(side_plane_b.points_, side_plane_b_filtered, 300, 0.10, true) &&
       side_plane_b_filtered.points_.size() < 7000 &&
       side_plane_b_filtered.points_.size() > 75)  // prevent dense planes and slow convex hulls
   {
     side_plane_b_filtered.id_ = 1;
     planes.push_back(side_plane_b_filtered);
   }
+}
+
+void VelodyneMapper::segmentSidePlanes(const SemiPlane& ground_plane, const Tf& tf, std::vector<Plane>& planes)
+{
+  // The ground plane is normalized once, so that the distance of a point to it does not need a square root
+  float ground_norm = std::sqrt(ground_plane.a_ * ground_plane.a_ + ground_plane.b_ * ground_plane.b_ +
+                                ground_plane.c_ * ground_plane.c_);
+  bool has_ground = ground_norm > 0;
+  float ga = has_ground ? ground_plane.a_ / ground_norm : 0;
+  float gb = has_ground ? ground_plane.b_ / ground_norm : 0;
+  float gc = has_ground ? ground_plane.c_ / ground_norm : 1;
+  float gd = has_ground ? ground_plane.d_ / ground_norm : 0;
 
   // -------------------------------------------------------------------------------
-  // ----- Check the validity of the extracted planes
+  // ----- Gather the segmented points and the moments of each segment
   // -------------------------------------------------------------------------------
-  for (auto& plane : planes)
+  // - only the points near the sensor and above the ground are used
+  // - the points of the segments too small to be valid are kept, since foliage is often split in many of them,
+  //   but only the valid segments are used as seeds
+  std::vector<PlanePoint>& segment_pts = segment_pts_;
+  std::vector<float>& segment_pts_y = segment_pts_y_;
+  std::vector<PlaneMoments>& segment_moments = segment_moments_;
+  segment_pts.clear();
+  segment_pts_y.clear();
+  segment_moments.assign(n_segments_ + 1, PlaneMoments());
+  double y_sum = 0.;
+  for (int i = 0; i < vertical_scans_; i++)
   {
-    // Check if the plane have a minimum number of points
-    plane.centroid_ = Point(0, 0, 0);
-    for (const auto& pt : plane.points_)
+    for (int j = 0; j < horizontal_scans_; j++)
     {
-      plane.centroid_ = plane.centroid_ + pt;
+      int label = label_mat_(i, j);
+      if (label <= 0)
+        continue;
+
+      const Point& pt = range_image_pcl_[j + i * horizontal_scans_];
+      if (pt.x_ * pt.x_ + pt.y_ * pt.y_ + pt.z_ * pt.z_ >= 25 ||
+          (has_ground && std::fabs(ga * pt.x_ + gb * pt.y_ + gc * pt.z_ + gd) <= 0.2))
+        continue;
+
+      float y = (pt * tf).y_;
+      y_sum += y;
+      segment_pts.emplace_back(pt, label);
+      segment_pts_y.push_back(y);
+      if (label != 999999)
+        segment_moments[label].add(pt);
     }
-    plane.centroid_ = plane.centroid_ / static_cast<float>(plane.points_.size());
-    plane.setLocalRefFrame();
+  }
+  if (segment_pts.empty())
+  {
+    return;
+  }
 
-    SemiPlane l_semi_plane;
-    bool ch = ConvexHull::process(plane, l_semi_plane);
-    if (ch && checkPlaneConsistency(l_semi_plane, ground_plane))
+  // -------------------------------------------------------------------------------
+  // ----- Split the points in the two sides of the row
+  // -------------------------------------------------------------------------------
+  // - the sides are split by the mean of the y component of the points, rotated to the map frame
+  // - the vertical segments go as a whole to the side of their centroid, and seed the plane of that side
+  auto y_mean = static_cast<float>(y_sum / static_cast<double>(segment_pts.size()));
+
+  std::vector<int8_t>& segment_side = segment_side_;
+  segment_side.assign(n_segments_ + 1, -1);
+  PlaneMoments seeds[2];
+  for (int label = 1; label <= n_segments_; label++)
+  {
+    float a, b, c, d;
+    const PlaneMoments& moments = segment_moments[label];
+    if (!moments.fit(a, b, c, d) || std::fabs(a * ga + b * gb + c * gc) > 0.7)
+      continue;
+
+    Point centroid(moments.x_ / moments.n_, moments.y_ / moments.n_, moments.z_ / moments.n_);
+    segment_side[label] = ((centroid * tf).y_ < y_mean) ? 0 : 1;
+    seeds[segment_side[label]] += moments;
+  }
+
+  Plane& side_plane_a = side_planes_[0];
+  Plane& side_plane_b = side_planes_[1];
+  side_plane_a.points_.clear();
+  side_plane_b.points_.clear();
+  PlaneMoments sides[2];
+  for (size_t i = 0; i < segment_pts.size(); i++)
+  {
+    const PlanePoint& plane_pt = segment_pts[i];
+    int side = (plane_pt.which_plane_ != 999999) ? segment_side[plane_pt.which_plane_] : -1;
+    if (side == -1)
+      side = (segment_pts_y[i] < y_mean) ? 0 : 1;
+
+    side_planes_[side].points_.push_back(plane_pt.pos_);
+    sides[side].add(plane_pt.pos_);
+  }
+
+  // - Fit each side starting from its seed, or from all of its points if it has no vertical segments, refining it
+  //   a few times to discard the outliers
+  for (int side = 0; side < 2; side++)
+  {
+    const PlaneMoments& seed = (seeds[side].n_ >= 3) ? seeds[side] : sides[side];
+
+    Plane side_plane_filtered;
+    if (PlaneFit::process(side_planes_[side].points_, seed, side_plane_filtered, 3, 0.10) &&
+        side_plane_filtered.points_.size() < 7000 &&
+        side_plane_filtered.points_.size() > 75)  // prevent dense planes and slow convex hulls
     {
-      out_planes.push_back(l_semi_plane);
+      side_plane_filtered.id_ = side;
+      planes.push_back(side_plane_filtered);
     }
   }
 }
@@ -971,276 +1338,446 @@ void VelodyneMapper::extractFeatures(const std::vector<PlanePoint>& in_plane_pts
                                      std::vector<Planar>& out_planars)
 
 {
+  // The points are processed in blocks, and the rings in groups, in parallel
+  // - each block only writes to its own points, and the marks that cross the border of a ring group only reach
+  //   points that are out of the sub-regions of the other groups
+
   // -------------------------------------------------------------------------------
   // ----- Compute cloud smoothness
   // -------------------------------------------------------------------------------
-  int* cloudPlanarLabel = new int[vertical_scans_ * horizontal_scans_];
-  int* cloudCornerLabel = new int[vertical_scans_ * horizontal_scans_];
   int l_cloud_size = in_plane_pts.size();
-  std::vector<smoothness_t> cloud_smoothness(vertical_scans_ * horizontal_scans_);
-  std::vector<int> neighbor_picked(vertical_scans_ * horizontal_scans_);
-  for (int i = 5; i < l_cloud_size - 5; i++)
-  {
-    // Compute smoothness and save it
-    float diff_range = seg_pcl_.range[i - 5] + seg_pcl_.range[i - 4] + seg_pcl_.range[i - 3] + seg_pcl_.range[i - 2] +
-                       seg_pcl_.range[i - 1] + seg_pcl_.range[i + 1] + seg_pcl_.range[i + 2] + seg_pcl_.range[i + 3] +
-                       seg_pcl_.range[i + 4] + seg_pcl_.range[i + 5] - 10 * seg_pcl_.range[i];
-
-    cloud_smoothness[i].value = diff_range * diff_range;
-    cloud_smoothness[i].idx = i;
+  std::vector<float>& smoothness = smoothness_;
+  std::vector<int>& neighbor_picked = neighbor_picked_;
+  std::vector<uint8_t>& occlusion = occlusion_;
+
+  // - the ranges of the 10 neighbours of each point are summed from a prefix sum, kept in double so that the
+  //   difference of two of its entries is as precise as the ranges themselves
+  // - the loop over the points has no dependencies between iterations, so that the compiler vectorizes it
+  std::vector<double>& range_sum = range_sum_;
+  range_sum[0] = 0.;
+  for (int i = 0; i < l_cloud_size; i++)
+    range_sum[i + 1] = range_sum[i] + seg_pcl_.range[i];
+
+  forEachBlock(l_cloud_size, [&](const int&, const int& begin, const int& end) {
+    std::fill(planar_label_.begin() + begin, planar_label_.begin() + end, 0);
+    std::fill(corner_label_.begin() + begin, corner_label_.begin() + end, 0);
+    std::fill(smoothness.begin() + begin, smoothness.begin() + end, 0.);
+    std::fill(occlusion.begin() + begin, occlusion.begin() + end, 0);
+
+    const float* range = seg_pcl_.range.data();
+    const double* sum = range_sum.data();
+    float* value = smoothness.data();
+    for (int i = std::max(begin, 5); i < std::min(end, l_cloud_size - 5); i++)
+    {
+      auto diff_range = static_cast<float>(sum[i + 6] - sum[i - 5] - 11. * range[i]);
+      value[i] = diff_range * diff_range;
+    }
+
+    // ---------------------------------------------------------------------------
+    // ----- Find occluded points
+    // ---------------------------------------------------------------------------
+    for (int i = std::max(begin, 5); i < std::min(end, l_cloud_size - 6); i++)
+    {
+      float depth1 = seg_pcl_.range[i];
+      float depth2 = seg_pcl_.range[i + 1];
+      int col_diff = std::abs(int(seg_pcl_.col_idx[i + 1] - seg_pcl_.col_idx[i]));
+
+      if (col_diff < 10)
+      {
+        if (depth1 - depth2 > 0.3)
+          occlusion[i] |= OCCLUDES_BACKWARD;
+        else if (depth2 - depth1 > 0.3)
+          occlusion[i] |= OCCLUDES_FORWARD;
+      }
 
-    cloudPlanarLabel[i] = 0;
-    cloudCornerLabel[i] = 0;
+      float diff1 = std::abs(float(seg_pcl_.range[i - 1] - seg_pcl_.range[i]));
+      float diff2 = std::abs(float(seg_pcl_.range[i + 1] - seg_pcl_.range[i]));
 
-    // Reset neighborhood flag array
-    neighbor_picked[i] = 0;
-  }
+      if (diff1 > 0.02 * seg_pcl_.range[i] && diff2 > 0.02 * seg_pcl_.range[i])
+        occlusion[i] |= OCCLUDED;
+    }
+  });
 
   // -------------------------------------------------------------------------------
   // ----- Mark occluded points
   // -------------------------------------------------------------------------------
-
-  for (int i = 5; i < l_cloud_size - 6; ++i)
-  {
-    float depth1 = seg_pcl_.range[i];
-    float depth2 = seg_pcl_.range[i + 1];
-    int col_diff = std::abs(int(seg_pcl_.col_idx[i + 1] - seg_pcl_.col_idx[i]));
-
-    if (col_diff < 10)
+  // - each point gathers the marks of its neighbours, instead of them scattering their marks, so that the blocks
+  //   do not write to each other: a point is marked by the next 6 points (including itself) that occlude backwards,
+  //   and by the previous 6 that occlude forwards
+  forEachBlock(l_cloud_size, [&](const int&, const int& begin, const int& end) {
+    for (int i = begin; i < end; i++)
     {
-      if (depth1 - depth2 > 0.3)
-      {
-        neighbor_picked[i - 5] = 1;
-        neighbor_picked[i - 4] = 1;
-        neighbor_picked[i - 3] = 1;
-        neighbor_picked[i - 2] = 1;
-        neighbor_picked[i - 1] = 1;
-        neighbor_picked[i] = 1;
-      }
-      else if (depth2 - depth1 > 0.3)
-      {
-        neighbor_picked[i + 1] = 1;
-        neighbor_picked[i + 2] = 1;
-        neighbor_picked[i + 3] = 1;
-        neighbor_picked[i + 4] = 1;
-        neighbor_picked[i + 5] = 1;
-        neighbor_picked[i + 6] = 1;
-      }
-    }
+      bool picked = (occlusion[i] & OCCLUDED) != 0;
+      for (int m = i; !picked && m <= std::min(i + 5, l_cloud_size - 1); m++)
+        picked = (occlusion[m] & OCCLUDES_BACKWARD) != 0;
+      for (int m = std::max(i - 6, 0); !picked && m < i; m++)
+        picked = (occlusion[m] & OCCLUDES_FORWARD) != 0;
 
-    float diff1 = std::abs(float(seg_pcl_.range[i - 1] - seg_pcl_.range[i]));
-    float diff2 = std::abs(float(seg_pcl_.range[i + 1] - seg_pcl_.range[i]));
-
-    if (diff1 > 0.02 * seg_pcl_.range[i] && diff2 > 0.02 * seg_pcl_.range[i])
-      neighbor_picked[i] = 1;
-  }
+      neighbor_picked[i] = picked ? 1 : 0;
+    }
+  });
 
   // -------------------------------------------------------------------------------
   // ----- Extract features from the 3D cloud
   // -------------------------------------------------------------------------------
-  std::vector<Planar> planar_points_less_flat;
+  // - each group of rings writes to its own buffers, that are then concatenated in the order of the rings
+  forEachBlock(vertical_scans_, [&](const int& t, const int& begin, const int& end) {
+    block_corners_[t].clear();
+    block_planars_[t].clear();
+    for (int i = begin; i < end; i++)
+      extractRingFeatures(in_plane_pts, i, block_candidates_[t], block_corners_[t], block_planars_[t]);
+  });
+
   int corner_id = 0;
-  int planar_id = 0;
-  for (int i = 0; i < vertical_scans_; i++)
+  for (uint32_t t = 0; t < n_threads_; t++)
   {
-    planar_points_less_flat.clear();
+    for (auto& corner : block_corners_[t])
+      corner.id_ = corner_id++;
+    out_corners.insert(out_corners.end(), block_corners_[t].begin(), block_corners_[t].end());
+    out_planars.insert(out_planars.end(), block_planars_[t].begin(), block_planars_[t].end());
+  }
+}
 
-    for (int k = 0; k < 6; k++)
-    {
-      // Compute start and end indexes of the sub-region
-      int sp = (seg_pcl_.start_col_idx[i] * (6 - k) + (seg_pcl_.end_col_idx[i] * k)) / 6;
-      int ep = (seg_pcl_.start_col_idx[i] * (5 - k) + (seg_pcl_.end_col_idx[i] * (k + 1))) / 6 - 1;
+void VelodyneMapper::extractRingFeatures(const std::vector<PlanePoint>& in_plane_pts, const int& ring,
+                                         std::vector<smoothness_t>& candidates, std::vector<Corner>& out_corners,
+                                         std::vector<Planar>& out_planars)
+{
+  std::vector<int>& cloudPlanarLabel = planar_label_;
+  std::vector<int>& cloudCornerLabel = corner_label_;
+  std::vector<int>& neighbor_picked = neighbor_picked_;
+  const float* value = smoothness_.data();
 
-      if (sp >= ep)
+  // Mark the neighbors of a feature to reject them as future features
+  auto mark_neighbors = [&](const int& idx) {
+    neighbor_picked[idx] = 1;
+    for (int m = 1; m <= 5; m++)
+    {
+      if (idx + m >= static_cast<int>(seg_pcl_.col_idx.size()))
         continue;
+      int col_diff = std::abs(seg_pcl_.col_idx[idx + m] - seg_pcl_.col_idx[idx + m - 1]);
+      if (col_diff > 10)
+        break;
+      else
+        neighbor_picked[idx + m] = 1;
+    }
+    for (int m = -1; m >= -5; m--)
+    {
+      if (idx + m < 0)
+        continue;
+      int col_diff = std::abs(seg_pcl_.col_idx[idx + m] - seg_pcl_.col_idx[idx + m + 1]);
+      if (col_diff > 10)
+        break;
+      else
+        neighbor_picked[idx + m] = 1;
+    }
+  };
 
-      // Sort smoothness values for the current sub-region
-      std::sort(cloud_smoothness.begin() + sp, cloud_smoothness.begin() + ep, by_value());
-
-      // -- Extract edge features
-      int picked_counter = 0;
-      for (int l = ep; l >= sp; l--)
-      {
-        int idx = cloud_smoothness[l].idx;
-
-        // Check if the current point is an edge feature
-        if (neighbor_picked[idx] == 0 && cloud_smoothness[l].value > edge_threshold_ && !seg_pcl_.is_ground[idx])
-        {
-          picked_counter++;
-          if (picked_counter <= picked_num_)
-          {
-            Corner l_corner(in_plane_pts[idx].pos_, in_plane_pts[idx].which_plane_, corner_id);
-            out_corners.push_back(l_corner);
-            corner_id++;
-          }
-          else
-          {
-            break;
-          }
+  // Only a few features are picked in each sub-region, so instead of sorting all of its points by smoothness, the
+  // candidates are selected lazily: they are heapified in linear time, and popped in order until enough are picked
+  // - as in the sort this replaces, that covered [sp, ep), the last point of the sub-region is the first edge
+  //   candidate and the last planar one
+  auto by_value_desc = [](const smoothness_t& left, const smoothness_t& right) { return left.value > right.value; };
 
-          cloudCornerLabel[idx] = -1;
+  for (int k = 0; k < 6; k++)
+  {
+    // Compute start and end indexes of the sub-region
+    int sp = (seg_pcl_.start_col_idx[ring] * (6 - k) + (seg_pcl_.end_col_idx[ring] * k)) / 6;
+    int ep = (seg_pcl_.start_col_idx[ring] * (5 - k) + (seg_pcl_.end_col_idx[ring] * (k + 1))) / 6 - 1;
 
-          // Mark neighbor points to reject as future features
-          neighbor_picked[idx] = 1;
-          for (int m = 1; m <= 5; m++)
-          {
-            if (idx + m >= static_cast<int>(seg_pcl_.col_idx.size()))
-              continue;
-            int col_diff = std::abs(seg_pcl_.col_idx[idx + m] - seg_pcl_.col_idx[idx + m - 1]);
-            if (col_diff > 10)
-              break;
-            else
-              neighbor_picked[idx + m] = 1;
-          }
-          for (int m = -1; m >= -5; m--)
-          {
-            if (idx + m < 0)
-              continue;
-            int col_diff = std::abs(seg_pcl_.col_idx[idx + m] - seg_pcl_.col_idx[idx + m + 1]);
-            if (col_diff > 10)
-              break;
-            else
-              neighbor_picked[idx + m] = 1;
-          }
-        }
-      }
+    if (sp >= ep)
+      continue;
 
-      // -- Extract planar features
-      picked_counter = 0;
-      for (int l = sp; l <= ep; l++)
-      {
-        int idx = cloud_smoothness[l].idx;
+    // -- Extract edge features
+    int picked_counter = 0;
+    auto pick_corner = [&](const int& idx) {
+      if (neighbor_picked[idx] != 0)
+        return;
 
-        // Check if the current point is a planar feature
-        if (neighbor_picked[idx] == 0 && cloud_smoothness[l].value < planar_threshold_)
-        {
-          cloudPlanarLabel[idx] = -1;
+      out_corners.emplace_back(in_plane_pts[idx].pos_, in_plane_pts[idx].which_plane_);
+      picked_counter++;
 
-          picked_counter++;
-          if (picked_counter >= 4)
-            break;
+      cloudCornerLabel[idx] = -1;
+      mark_neighbors(idx);
+    };
 
-          neighbor_picked[idx] = 1;
-          for (int m = 1; m <= 5; m++)
-          {
-            int col_diff = std::abs(seg_pcl_.col_idx[idx + m] - seg_pcl_.col_idx[idx + m - 1]);
+    if (value[ep] > edge_threshold_ && !seg_pcl_.is_ground[ep])
+      pick_corner(ep);
 
-            if (col_diff > 10)
-              break;
-            else
-              neighbor_picked[idx + m] = 1;
-          }
-          for (int m = -1; m >= -5; m--)
-          {
-            if (idx + m < 0)
-              continue;
-            int col_diff = std::abs(seg_pcl_.col_idx[idx + m] - seg_pcl_.col_idx[idx + m + 1]);
-            if (col_diff > 10)
-              break;
-            else
-              neighbor_picked[idx + m] = 1;
-          }
-        }
-      }
+    candidates.clear();
+    for (int l = sp; l < ep; l++)
+    {
+      if (value[l] > edge_threshold_ && !seg_pcl_.is_ground[l])
+        candidates.push_back(smoothness_t{ value[l], static_cast<size_t>(l) });
+    }
+    std::make_heap(candidates.begin(), candidates.end(), by_value());
+    while (picked_counter < picked_num_ && !candidates.empty())
+    {
+      std::pop_heap(candidates.begin(), candidates.end(), by_value());
+      pick_corner(static_cast<int>(candidates.back().idx));
+      candidates.pop_back();
+    }
 
-      for (int l = sp; l <= ep; l++)
-      {
-        if (cloudPlanarLabel[l] <= 0 && cloudCornerLabel[l] >= 0)
-        {
-          Planar planar(in_plane_pts[l].pos_, in_plane_pts[l].which_plane_, planar_id);
-          planar_points_less_flat.push_back(planar);
-        }
-      }
+    // -- Extract planar features
+    // - the fourth planar point is labeled, but does not reject its neighbors
+    picked_counter = 0;
+    auto pick_planar = [&](const int& idx) {
+      if (neighbor_picked[idx] != 0)
+        return;
+
+      cloudPlanarLabel[idx] = -1;
+
+      picked_counter++;
+      if (picked_counter < 4)
+        mark_neighbors(idx);
+    };
+
+    candidates.clear();
+    for (int l = sp; l < ep; l++)
+    {
+      if (value[l] < planar_threshold_)
+        candidates.push_back(smoothness_t{ value[l], static_cast<size_t>(l) });
+    }
+    std::make_heap(candidates.begin(), candidates.end(), by_value_desc);
+    while (picked_counter < 4 && !candidates.empty())
+    {
+      std::pop_heap(candidates.begin(), candidates.end(), by_value_desc);
+      pick_planar(static_cast<int>(candidates.back().idx));
+      candidates.pop_back();
     }
 
-    out_planars.insert(out_planars.end(), planar_points_less_flat.begin(), planar_points_less_flat.end());
-  }
+    if (picked_counter < 4 && value[ep] < planar_threshold_)
+      pick_planar(ep);
 
-  free(cloudCornerLabel);
-  free(cloudPlanarLabel);
+    for (int l = sp; l <= ep; l++)
+    {
+      if (cloudPlanarLabel[l] <= 0 && cloudCornerLabel[l] >= 0)
+        out_planars.emplace_back(in_plane_pts[l].pos_, in_plane_pts[l].which_plane_);
+    }
+  }
 }
-void VelodyneMapper::reset()
+
+void VelodyneMapper::allocate()
 {
+  int cloud_size = vertical_scans_ * horizontal_scans_;
+
   range_mat_.resize(vertical_scans_, horizontal_scans_);
   ground_mat_.resize(vertical_scans_, horizontal_scans_);
   label_mat_.resize(vertical_scans_, horizontal_scans_);
+
+  seg_pcl_.start_col_idx.resize(vertical_scans_);
+  seg_pcl_.end_col_idx.resize(vertical_scans_);
+  seg_pcl_.is_ground.resize(cloud_size);
+  seg_pcl_.col_idx.resize(cloud_size);
+  seg_pcl_.range.resize(cloud_size);
+
+  range_image_pcl_.resize(cloud_size);
+  cloud_seg_.reserve(cloud_size);
+  ground_candidates_.points_.reserve(2 * cloud_size);
+  segment_queue_.reserve(cloud_size);
+  parent_.resize(cloud_size);
+  segment_stats_.resize(cloud_size);
+  line_count_flag_.resize(vertical_scans_);
+  non_ground_.reserve(cloud_size);
+  side_planes_[0].points_.reserve(cloud_size);
+  side_planes_[1].points_.reserve(cloud_size);
+  segment_pts_.reserve(cloud_size);
+  segment_pts_y_.reserve(cloud_size);
+  smoothness_.resize(cloud_size);
+  range_sum_.resize(cloud_size + 1);
+  neighbor_picked_.resize(cloud_size);
+  occlusion_.resize(cloud_size);
+  planar_label_.resize(cloud_size);
+  corner_label_.resize(cloud_size);
+  ring_offset_.resize(vertical_scans_ + 1);
+  block_candidates_.resize(n_threads_);
+  block_ground_.resize(n_threads_);
+  block_moments_.resize(n_threads_);
+  ground_bins_.resize(static_cast<size_t>(std::ceil(2 * lidar_height_ / ground_bin_size_)));
+  ground_slabs_.resize(ground_bins_.size());
+  ground_hypotheses_.reserve(GROUND_HYPOTHESES);
+  block_corners_.resize(n_threads_);
+  block_planars_.resize(n_threads_);
+  for (uint32_t t = 0; t < n_threads_; t++)
+  {
+    block_candidates_[t].reserve(horizontal_scans_);
+    block_planars_[t].reserve(cloud_size / n_threads_);
+    block_ground_[t].reserve(2 * cloud_size / n_threads_);
+    block_moments_[t].resize(ground_bins_.size());
+  }
+}
+
+void VelodyneMapper::fitColumns(const uint32_t& n_columns)
+{
+  if (n_columns == 0 || static_cast<int>(n_columns) == horizontal_scans_)
+  {
+    return;
+  }
+
+  // The driver decides the width of its range image (e.g. the os1 1024 and 2048 modes), so the columns it gives are
+  // only adjacent, and wrap around, in an image of that width - this only happens on the first scan
+  std::cout << "VelodyneMapper::fitColumns() --- the driver gives " << n_columns << " columns and the " << model_.name_
+            << " model " << model_.horizontal_scans_ << ", using the driver ones.\n";
+  horizontal_scans_ = static_cast<int>(n_columns);
+  ang_res_x_ = M_2PI / static_cast<float>(horizontal_scans_);
+  horizontal_link_ = std::sin(ang_res_x_ + planes_th_);
+  allocate();
+}
+
+void VelodyneMapper::fitColumns(const std::vector<Point>& pcl, const std::vector<uint16_t>& rings,
+                                const std::vector<uint16_t>& columns)
+{
+  if (rings.size() != pcl.size() || columns.size() != pcl.size() || columns.empty())
+  {
+    return;
+  }
+
+  // Without the driver width, make sure that no column is dropped
+  uint32_t n_columns = *std::max_element(columns.begin(), columns.end()) + 1;
+  if (static_cast<int>(n_columns) > horizontal_scans_)
+  {
+    fitColumns(n_columns);
+  }
+}
+
+void VelodyneMapper::reset()
+{
   range_mat_.fill(-1);
   ground_mat_.setZero();
   label_mat_.setZero();
 
-  int cloud_size = vertical_scans_ * horizontal_scans_;
-
-  seg_pcl_.start_col_idx.assign(vertical_scans_, 0);
-  seg_pcl_.end_col_idx.assign(vertical_scans_, 0);
-  seg_pcl_.is_ground.assign(cloud_size, false);
-  seg_pcl_.col_idx.assign(cloud_size, 0);
-  seg_pcl_.range.assign(cloud_size, 0);
+  std::fill(seg_pcl_.start_col_idx.begin(), seg_pcl_.start_col_idx.end(), 0);
+  std::fill(seg_pcl_.end_col_idx.begin(), seg_pcl_.end_col_idx.end(), 0);
+  std::fill(seg_pcl_.is_ground.begin(), seg_pcl_.is_ground.end(), false);
+  std::fill(seg_pcl_.col_idx.begin(), seg_pcl_.col_idx.end(), 0);
+  std::fill(seg_pcl_.range.begin(), seg_pcl_.range.end(), 0);
 }
 
-void VelodyneMapper::localMap(const std::vector<Point>& pcl, std::vector<Corner>& out_corners,
-                              std::vector<Planar>& out_planars, std::vector<SemiPlane>& out_planes,
-                              SemiPlane& out_groundplane)
+const std::vector<Point>& VelodyneMapper::voxelFilter(const std::vector<Point>& pcl,
+                                                      const std::vector<uint16_t>& rings,
+                                                      const std::vector<uint16_t>& columns)
 {
-  // Build velodyne to base_link transformation matrix
-  Pose tf_pose(laser2base_x_, laser2base_y_, laser2base_z_, laser2base_roll_, laser2base_pitch_, laser2base_yaw_);
-  Tf tf;
-  std::array<float, 9> tf_rot{};
-  tf_pose.toRotMatrix(tf_rot);
-  tf = Tf(tf_rot, std::array<float, 3>{ tf_pose.x_, tf_pose.y_, tf_pose.z_ });
+  const std::vector<Point>& out_pcl = LidarMapper::voxelFilter(pcl);
 
-  // Reset global variables and members
-  reset();
-
-  // Range image projection
-  const size_t cloud_size = pcl.size();
-  std::vector<Point> transformed_pcl(vertical_scans_ * horizontal_scans_);
-  for (size_t i = 0; i < cloud_size; ++i)
+  // The rings and columns of the kept points, if the scan is organized
+  voxel_rings_.clear();
+  voxel_columns_.clear();
+  if (rings.size() == pcl.size())
+  {
+    for (const auto& idx : voxel_idx_)
+      voxel_rings_.push_back(rings[idx]);
+  }
+  if (columns.size() == pcl.size())
   {
-    Point l_pt = pcl[i];
+    for (const auto& idx : voxel_idx_)
+      voxel_columns_.push_back(columns[idx]);
+  }
 
-    float range = l_pt.norm3D();
+  return out_pcl;
+}
 
-    // find the row and column index in the image for this point
-    float vertical_angle = std::atan2(l_pt.z_, std::sqrt(l_pt.x_ * l_pt.x_ + l_pt.y_ * l_pt.y_));
+void VelodyneMapper::projectToRangeImage(const std::vector<Point>& pcl, const std::vector<uint16_t>& rings,
+                                         const std::vector<uint16_t>& columns, std::vector<Point>& out_pcl)
+{
+  bool organized = rings.size() == pcl.size();
+  bool has_columns = organized && columns.size() == pcl.size();
 
-    int row_idx = static_cast<int>((vertical_angle + vertical_angle_bottom_) / ang_res_y_);
-    ang_res_y_ = static_cast<float>(2.) * DEGREE_TO_RAD;
-    if (row_idx < 0 || row_idx >= vertical_scans_)
+  std::fill(out_pcl.begin(), out_pcl.end(), Point());
+  for (size_t i = 0; i < pcl.size(); i++)
+  {
+    const Point& l_pt = pcl[i];
+    if (std::fabs(l_pt.x_) < 0.9 && std::fabs(l_pt.y_) < 0.4)
     {
       continue;
     }
 
-    float horizon_angle = std::atan2(l_pt.x_, l_pt.y_);  // this is not an error
-
-    int column_idx = static_cast<int>(-round((horizon_angle - M_PI_2) / ang_res_x_) + horizontal_scans_ / 2.);
-
-    if (column_idx >= horizontal_scans_)
+    float range = l_pt.norm3D();
+    if (range > 50.0)
     {
-      column_idx -= horizontal_scans_;
+      continue;
     }
 
-    if (column_idx < 0 || column_idx >= horizontal_scans_)
+    // Find the row and column index in the image for this point
+    // - in an organized scan, they are given by the driver
+    int row_idx = organized ? model_.ringToRow(rings[i]) : model_.row(l_pt.z_, range);
+    if (row_idx < 0)
     {
       continue;
     }
-
-    if (range > 50.0 || (std::fabs(l_pt.x_) < 0.9 && std::fabs(l_pt.y_) < 0.4))
+    // - otherwise, the sensor model column is scaled to the driver range image width
+    int column_idx = has_columns ? columns[i] : model_.column(l_pt.x_, l_pt.y_);
+    if (!has_columns && horizontal_scans_ != model_.horizontal_scans_)
+    {
+      column_idx = (column_idx * horizontal_scans_) / model_.horizontal_scans_;
+    }
+    if (column_idx >= horizontal_scans_)
     {
       continue;
     }
 
     range_mat_(row_idx, column_idx) = range;
-
-    size_t idx = column_idx + row_idx * horizontal_scans_;
-    transformed_pcl[idx] = l_pt;
+    out_pcl[column_idx + row_idx * horizontal_scans_] = l_pt;
   }
+}
+
+void VelodyneMapper::localMap(const LidarScan& scan, std::vector<Corner>& out_corners,
+                              std::vector<Planar>& out_planars, std::vector<SemiPlane>& out_planes,
+                              SemiPlane& out_groundplane)
+{
+  fitColumns(scan.n_columns_);
+  localMap(scan.pts_, scan.rings_, scan.columns_, out_corners, out_planars, out_planes, out_groundplane);
+}
+
+void VelodyneMapper::localMap(const LidarScan& scan, std::vector<Corner>& out_corners,
+                              std::vector<Planar>& out_planars, SemiPlane& out_groundplane)
+{
+  fitColumns(scan.n_columns_);
+  localMap(scan.pts_, scan.rings_, scan.columns_, out_corners, out_planars, out_groundplane);
+}
+
+void VelodyneMapper::localMap(const std::vector<Point>& pcl, std::vector<Corner>& out_corners,
+                              std::vector<Planar>& out_planars, std::vector<SemiPlane>& out_planes,
+                              SemiPlane& out_groundplane)
+{
+  localMap(pcl, {}, {}, out_corners, out_planars, out_planes, out_groundplane);
+}
+
+void VelodyneMapper::localMap(const std::vector<Point>& pcl, std::vector<Corner>& out_corners,
+                              std::vector<Planar>& out_planars, SemiPlane& out_groundplane)
+{
+  localMap(pcl, {}, {}, out_corners, out_planars, out_groundplane);
+}
+
+void VelodyneMapper::localMap(const std::vector<Point>& pcl, const std::vector<uint16_t>& rings,
+                              const std::vector<uint16_t>& columns, std::vector<Corner>& out_corners,
+                              std::vector<Planar>& out_planars, std::vector<SemiPlane>& out_planes,
+                              SemiPlane& out_groundplane)
+{
+  // Build velodyne to base_link transformation matrix
+  Pose tf_pose(laser2base_x_, laser2base_y_, laser2base_z_, laser2base_roll_, laser2base_pitch_, laser2base_yaw_);
+  Tf tf;
+  std::array<float, 9> tf_rot{};
+  tf_pose.toRotMatrix(tf_rot);
+  tf = Tf(tf_rot, std::array<float, 3>{ tf_pose.x_, tf_pose.y_, tf_pose.z_ });
+
+  // Reset global variables and members, with the range image as wide as the driver one
+  fitColumns(pcl, rings, columns);
+  reset();
+
+  // Range image projection, of the scan downsampled by the voxel grid if it is enabled
+  std::vector<Point>& transformed_pcl = range_image_pcl_;
+  if (voxel_grid_.enabled())
+    projectToRangeImage(voxelFilter(pcl, rings, columns), voxel_rings_, voxel_columns_, transformed_pcl);
+  else
+    projectToRangeImage(pcl, rings, columns, transformed_pcl);
 
   // - Ground plane processing
-  Plane unfiltered_gplane, filtered_gplane;
-  // A - Extraction
-  flatGroundRemoval(transformed_pcl, unfiltered_gplane);
+  Plane& ground_candidates = ground_candidates_;
+  std::vector<PlaneMoments>& ground_hypotheses = ground_hypotheses_;
+  Plane filtered_gplane;
+  // A - Extraction, along with the raw ground points
+  groundSegmentation(transformed_pcl, ground_candidates, ground_hypotheses);
   // B - Filtering
-  Ransac::process(unfiltered_gplane.points_, filtered_gplane, 100, 0.01, true);
+  PlaneFit::process(ground_candidates.points_, ground_hypotheses, filtered_gplane, 4, 0.01);
   // C - Centroid calculation
   for (const auto& pt : filtered_gplane.points_)
   {
@@ -1264,22 +1801,8 @@ void VelodyneMapper::localMap(const std::vector<Point>& pcl, std::vector<Corner>
     out_groundplane = SemiPlane();
   }
 
-  // -------------------------------------------------------------------------------
-  // ----- Mark raw ground points
-  // -------------------------------------------------------------------------------
-  Plane non_flat_ground;
-  groundRemoval(transformed_pcl, non_flat_ground);
-  for (const auto& index : non_flat_ground.indexes_)
-  {
-    int i = static_cast<int>(index.x_);
-    int j = static_cast<int>(index.y_);
-
-    ground_mat_(i, j) = 1;
-    label_mat_(i, j) = -1;
-  }
-
   // - Planes that are not the ground
-  std::vector<PlanePoint> cloud_seg;
+  std::vector<PlanePoint>& cloud_seg = cloud_seg_;
   cloudSegmentation(transformed_pcl, cloud_seg);
 
   // - Extract high level planes, and then convert them to semi-planes
@@ -1311,7 +1834,8 @@ void VelodyneMapper::localMap(const std::vector<Point>& pcl, std::vector<Corner>
   }
 }
 
-void VelodyneMapper::localMap(const std::vector<Point>& pcl, std::vector<Corner>& out_corners,
+void VelodyneMapper::localMap(const std::vector<Point>& pcl, const std::vector<uint16_t>& rings,
+                              const std::vector<uint16_t>& columns, std::vector<Corner>& out_corners,
                               std::vector<Planar>& out_planars, SemiPlane& out_groundplane)
 {
   // Build velodyne to base_link transformation matrix
@@ -1321,59 +1845,25 @@ void VelodyneMapper::localMap(const std::vector<Point>& pcl, std::vector<Corner>
   tf_pose.toRotMatrix(tf_rot);
   tf = Tf(tf_rot, std::array<float, 3>{ tf_pose.x_, tf_pose.y_, tf_pose.z_ });
 
-  // Reset global variables and members
+  // Reset global variables and members, with the range image as wide as the driver one
+  fitColumns(pcl, rings, columns);
   reset();
 
-  // Range image projection
-  const size_t cloud_size = pcl.size();
-  std::vector<Point> transformed_pcl(vertical_scans_ * horizontal_scans_);
-  for (size_t i = 0; i < cloud_size; ++i)
-  {
-    Point l_pt = pcl[i];
-
-    float range = l_pt.norm3D();
-
-    // find the row and column index in the image for this point
-    float vertical_angle = std::atan2(l_pt.z_, std::sqrt(l_pt.x_ * l_pt.x_ + l_pt.y_ * l_pt.y_));
-
-    int row_idx = static_cast<int>((vertical_angle + vertical_angle_bottom_) / ang_res_y_);
-    ang_res_y_ = static_cast<float>(2.) * DEGREE_TO_RAD;
-    if (row_idx < 0 || row_idx >= vertical_scans_)
-    {
-      continue;
-    }
-
-    float horizon_angle = std::atan2(l_pt.x_, l_pt.y_);  // this is not an error
-
-    int column_idx = static_cast<int>(-round((horizon_angle - M_PI_2) / ang_res_x_) + horizontal_scans_ / 2.);
-
-    if (column_idx >= horizontal_scans_)
-    {
-      column_idx -= horizontal_scans_;
-    }
-
-    if (column_idx < 0 || column_idx >= horizontal_scans_)
-    {
-      continue;
-    }
-
-    if (range > 50.0 || (std::fabs(l_pt.x_) < 0.9 && std::fabs(l_pt.y_) < 0.4))
-    {
-      continue;
-    }
-
-    range_mat_(row_idx, column_idx) = range;
-
-    size_t idx = column_idx + row_idx * horizontal_scans_;
-    transformed_pcl[idx] = l_pt;
-  }
+  // Range image projection, of the scan downsampled by the voxel grid if it is enabled
+  std::vector<Point>& transformed_pcl = range_image_pcl_;
+  if (voxel_grid_.enabled())
+    projectToRangeImage(voxelFilter(pcl, rings, columns), voxel_rings_, voxel_columns_, transformed_pcl);
+  else
+    projectToRangeImage(pcl, rings, columns, transformed_pcl);
 
   // - Ground plane processing
-  Plane unfiltered_gplane, filtered_gplane;
-  // A - Extraction
-  flatGroundRemoval(transformed_pcl, unfiltered_gplane);
+  Plane& ground_candidates = ground_candidates_;
+  std::vector<PlaneMoments>& ground_hypotheses = ground_hypotheses_;
+  Plane filtered_gplane;
+  // A - Extraction, along with the raw ground points
+  groundSegmentation(transformed_pcl, ground_candidates, ground_hypotheses);
   // B - Filtering
-  Ransac::process(unfiltered_gplane.points_, filtered_gplane, 100, 0.01, true);
+  PlaneFit::process(ground_candidates.points_, ground_hypotheses, filtered_gplane, 4, 0.01);
   // C - Centroid calculation
   for (const auto& pt : filtered_gplane.points_)
   {
@@ -1397,22 +1887,8 @@ void VelodyneMapper::localMap(const std::vector<Point>& pcl, std::vector<Corner>
     out_groundplane = SemiPlane();
   }
 
-  // -------------------------------------------------------------------------------
-  // ----- Mark raw ground points
-  // -------------------------------------------------------------------------------
-  Plane non_flat_ground;
-  groundRemoval(transformed_pcl, non_flat_ground);
-  for (const auto& index : non_flat_ground.indexes_)
-  {
-    int i = static_cast<int>(index.x_);
-    int j = static_cast<int>(index.y_);
-
-    ground_mat_(i, j) = 1;
-    label_mat_(i, j) = -1;
-  }
-
   // - Planes that are not the ground
-  std::vector<PlanePoint> cloud_seg;
+  std::vector<PlanePoint>& cloud_seg = cloud_seg_;
   cloudSegmentation(transformed_pcl, cloud_seg);
 
   //- Corners feature extraction
@@ -1452,14 +1928,17 @@ LivoxMapper::LivoxMapper(const Parameters& params)
 
   // Set ground plane settings
   ground_th_ = static_cast<float>(3.) * DEGREE_TO_RAD;
-  horizontal_scans_ = 1800;
-  ground_scan_idx_ = 7;
-  lidar_height_ = 1.20;
-  vertical_scans_ = 16;
-  horizontal_scans_ = 1800;
-  vertical_angle_bottom_ = static_cast<float>(15. + 0.1) * DEGREE_TO_RAD;
-  ang_res_x_ = static_cast<float>(0.2) * DEGREE_TO_RAD;
-  ang_res_y_ = static_cast<float>(2.) * DEGREE_TO_RAD;
+  lidar_height_ = params.lidar_height_;
+
+  // Set the bin grid over the field of view of the sensor - by default, the circular one of the Mid-40 (38.4 degrees)
+  // with a small margin
+  fov_half_angle_ = params.livox_fov_half_angle_ * DEGREE_TO_RAD;
+  fov_bin_res_ = std::max(params.livox_fov_bin_res_, static_cast<float>(0.05)) * DEGREE_TO_RAD;
+  fov_bins_ = static_cast<int>(std::ceil(2 * fov_half_angle_ / fov_bin_res_));
+  ground_bin_gap_ = 4;
+
+  // Set the voxel grid prefilter
+  voxel_grid_ = VoxelGrid(params.lidar_voxel_size_, params.lidar_voxel_centroid_);
 
   // Set robot dimensions for elevation map computation
   robot_dim_x_ = params.robot_dim_x_;
@@ -1470,6 +1949,18 @@ LivoxMapper::LivoxMapper(const Parameters& params)
   prev_robot_pose_ = Pose(0, 0, 0, 0, 0, 0);
 }
 
+void LivoxMapper::localMap(const LidarScan& scan, std::vector<Corner>& out_corners, std::vector<Planar>& out_planars,
+                           std::vector<SemiPlane>& out_planes, SemiPlane& out_groundplane)
+{
+  localMap(scan.pts_, scan.time_stamp_, out_corners, out_planars, out_planes, out_groundplane);
+}
+
+void LivoxMapper::localMap(const LidarScan& scan, std::vector<Corner>& out_corners, std::vector<Planar>& out_planars,
+                           SemiPlane& out_groundplane)
+{
+  localMap(scan.pts_, scan.time_stamp_, out_corners, out_planars, out_groundplane);
+}
+
 void LivoxMapper::localMap(const std::vector<Point>& pcl, const double& time_stamp, std::vector<Corner>& out_corners,
                            std::vector<Planar>& out_planars, std::vector<SemiPlane>& out_planes,
                            SemiPlane& out_groundplane)
@@ -1481,57 +1972,22 @@ void LivoxMapper::localMap(const std::vector<Point>& pcl, const double& time_sta
   tf_pose.toRotMatrix(tf_rot);
   tf = Tf(tf_rot, std::array<float, 3>{ tf_pose.x_, tf_pose.y_, tf_pose.z_ });
 
+  // Downsample the scan with the voxel grid, if enabled
+  const std::vector<Point>& in_pcl = voxelFilter(pcl);
+
   // Extract livox features
-  std::vector<std::vector<Point>> laser_cloud_scans = extractLaserFeatures(pcl, time_stamp);
+  std::vector<std::vector<Point>> laser_cloud_scans = extractLaserFeatures(in_pcl, time_stamp);
   std::vector<Point> tmp_corners, tmp_planars, tmp_full;
   getFeatures(tmp_corners, tmp_planars, tmp_full);
 
-  // Range image projection
-  const size_t cloud_size = pcl.size();
-  std::vector<Point> transformed_pcl(vertical_scans_ * horizontal_scans_);
-  for (size_t i = 0; i < cloud_size; ++i)
-  {
-    Point l_pt = pcl[i];
-
-    float range = l_pt.norm3D();
-
-    // find the row and column index in the image for this point
-    float vertical_angle = std::atan2(l_pt.z_, std::sqrt(l_pt.x_ * l_pt.x_ + l_pt.y_ * l_pt.y_));
-
-    int row_idx = static_cast<int>((vertical_angle + vertical_angle_bottom_) / ang_res_y_);
-    if (row_idx < 0 || row_idx >= vertical_scans_)
-    {
-      continue;
-    }
-
-    float horizon_angle = std::atan2(l_pt.x_, l_pt.y_);  // this is not an error
-
-    int column_idx = static_cast<int>(-round((horizon_angle - M_PI_2) / ang_res_x_) + horizontal_scans_ / 2.);
-
-    if (column_idx >= horizontal_scans_)
-    {
-      column_idx -= horizontal_scans_;
-    }
-
-    if (column_idx < 0 || column_idx >= horizontal_scans_)
-    {
-      continue;
-    }
-
-    if (range > 50.0 || (std::fabs(l_pt.x_) < 0.9 && std::fabs(l_pt.y_) < 0.4))
-    {
-      continue;
-    }
-
-    size_t idx = column_idx + row_idx * horizontal_scans_;
-    transformed_pcl[idx] = l_pt;
-  }
+  // Project the points onto the bins of the field of view
+  fovBinProjection(in_pcl);
 
   // Extract ground plane
   Plane unfiltered_gplane, filtered_gplane;
-  flatGroundRemoval(transformed_pcl, unfiltered_gplane);
+  flatGroundRemoval(unfiltered_gplane);
   // B - Filtering
-  Ransac::process(unfiltered_gplane.points_, filtered_gplane, 100, 0.01, true);
+  Ransac::processAdaptive(unfiltered_gplane.points_, filtered_gplane, 100, 0.01, true);
   // C - Centroid calculation
   for (const auto& pt : filtered_gplane.points_)
   {
@@ -1542,7 +1998,7 @@ void LivoxMapper::localMap(const std::vector<Point>& pcl, const double& time_sta
   ConvexHull::process(filtered_gplane, out_groundplane);
 
   // - Extract high level planes, and then convert them to semi-planes
-  extractHighLevelPlanes(transformed_pcl, out_groundplane, out_planes);
+  extractHighLevelPlanes(bin_closest_pts_, out_groundplane, out_planes);
 
   // Convert features to VineSLAM type and project them to the base_link
   for (const auto& pt : tmp_corners)
@@ -1595,57 +2051,22 @@ void LivoxMapper::localMap(const std::vector<Point>& pcl, const double& time_sta
   tf_pose.toRotMatrix(tf_rot);
   tf = Tf(tf_rot, std::array<float, 3>{ tf_pose.x_, tf_pose.y_, tf_pose.z_ });
 
+  // Downsample the scan with the voxel grid, if enabled
+  const std::vector<Point>& in_pcl = voxelFilter(pcl);
+
   // Extract livox features
-  std::vector<std::vector<Point>> laser_cloud_scans = extractLaserFeatures(pcl, time_stamp);
+  std::vector<std::vector<Point>> laser_cloud_scans = extractLaserFeatures(in_pcl, time_stamp);
   std::vector<Point> tmp_corners, tmp_planars, tmp_full;
   getFeatures(tmp_corners, tmp_planars, tmp_full);
 
-  // Range image projection
-  const size_t cloud_size = pcl.size();
-  std::vector<Point> transformed_pcl(vertical_scans_ * horizontal_scans_);
-  for (size_t i = 0; i < cloud_size; ++i)
-  {
-    Point l_pt = pcl[i];
-
-    float range = l_pt.norm3D();
-
-    // find the row and column index in the image for this point
-    float vertical_angle = std::atan2(l_pt.z_, std::sqrt(l_pt.x_ * l_pt.x_ + l_pt.y_ * l_pt.y_));
-
-    int row_idx = static_cast<int>((vertical_angle + vertical_angle_bottom_) / ang_res_y_);
-    if (row_idx < 0 || row_idx >= vertical_scans_)
-    {
-      continue;
-    }
-
-    float horizon_angle = std::atan2(l_pt.x_, l_pt.y_);  // this is not an error
-
-    int column_idx = static_cast<int>(-round((horizon_angle - M_PI_2) / ang_res_x_) + horizontal_scans_ / 2.);
-
-    if (column_idx >= horizontal_scans_)
-    {
-      column_idx -= horizontal_scans_;
-    }
-
-    if (column_idx < 0 || column_idx >= horizontal_scans_)
-    {
-      continue;
-    }
-
-    if (range > 50.0 || (std::fabs(l_pt.x_) < 0.9 && std::fabs(l_pt.y_) < 0.4))
-    {
-      continue;
-    }
-
-    size_t idx = column_idx + row_idx * horizontal_scans_;
-    transformed_pcl[idx] = l_pt;
-  }
+  // Project the points onto the bins of the field of view
+  fovBinProjection(in_pcl);
 
   // Extract ground plane
   Plane unfiltered_gplane, filtered_gplane;
-  flatGroundRemoval(transformed_pcl, unfiltered_gplane);
+  flatGroundRemoval(unfiltered_gplane);
   // B - Filtering
-  Ransac::process(unfiltered_gplane.points_, filtered_gplane, 100, 0.01, true);
+  Ransac::processAdaptive(unfiltered_gplane.points_, filtered_gplane, 100, 0.01, true);
   // C - Centroid calculation
   for (const auto& pt : filtered_gplane.points_)
   {
@@ -1684,16 +2105,6 @@ void LivoxMapper::localMap(const std::vector<Point>& pcl, const double& time_sta
   }
 }
 
-Pt_infos* LivoxMapper::findPtInfo(const Point& pt)
-{
-  map_pt_idx_it_ = map_pt_idx_.find(pt);
-  if (map_pt_idx_it_ == map_pt_idx_.end())
-  {
-    assert(map_pt_idx_it_ != map_pt_idx_.end());  // else, there must be something error happened before.
-  }
-  return map_pt_idx_it_->second;
-}
-
 void LivoxMapper::getFeatures(std::vector<Point>& pc_corners, std::vector<Point>& pc_surface,
                               std::vector<Point>& pc_full_res, float minimum_blur, float maximum_blur)
 {
@@ -1748,35 +2159,34 @@ void LivoxMapper::getFeatures(std::vector<Point>& pc_corners, std::vector<Point>
   pc_full_res.resize(full_num);
 }
 
-void LivoxMapper::setIntensity(Point& pt, const E_intensity_type& i_type)
+void LivoxMapper::setIntensity(Point& pt, const Pt_infos& pt_info, const E_intensity_type& i_type)
 {
-  Pt_infos* pt_info = findPtInfo(pt);
   switch (i_type)
   {
     case (e_I_raw):
-      pt.intensity_ = pt_info->raw_intensity_;
+      pt.intensity_ = pt_info.raw_intensity_;
       break;
     case (e_I_motion_blur):
-      pt.intensity_ = ((float)pt_info->idx_) / (float)input_points_size_;
+      pt.intensity_ = ((float)pt_info.idx_) / (float)input_points_size_;
       assert(pt.intensity_ <= 1.0 && pt.intensity_ >= 0.0);
       break;
     case (e_I_motion_mix):
-      pt.intensity_ = 0.1 * ((float)pt_info->idx_ + 1) / (float)input_points_size_ + (int)(pt_info->raw_intensity_);
+      pt.intensity_ = 0.1 * ((float)pt_info.idx_ + 1) / (float)input_points_size_ + (int)(pt_info.raw_intensity_);
       break;
     case (e_I_scan_angle):
-      pt.intensity_ = pt_info->polar_angle_;
+      pt.intensity_ = pt_info.polar_angle_;
       break;
     case (e_I_curvature):
-      pt.intensity_ = pt_info->curvature_;
+      pt.intensity_ = pt_info.curvature_;
       break;
     case (e_I_view_angle):
-      pt.intensity_ = pt_info->view_angle_;
+      pt.intensity_ = pt_info.view_angle_;
       break;
     case (e_I_time_stamp):
-      pt.intensity_ = pt_info->time_stamp_;
+      pt.intensity_ = pt_info.time_stamp_;
       break;
     default:
-      pt.intensity_ = ((float)pt_info->idx_ + 1) / (float)input_points_size_;
+      pt.intensity_ = ((float)pt_info.idx_ + 1) / (float)input_points_size_;
       break;
   }
   return;
@@ -1816,124 +2226,117 @@ void LivoxMapper::evalPoint(Pt_infos* pt_info)
   }
 }
 
-template <typename T>
-T LivoxMapper::vector_angle(const Eigen::Matrix<T, 3, 1>& vec_a, const Eigen::Matrix<T, 3, 1>& vec_b,
-                            int if_force_sharp_angle)
+void LivoxMapper::computeFeatures()
 {
-  T vec_a_norm = vec_a.norm();
-  T vec_b_norm = vec_b.norm();
-  if (vec_a_norm == 0 || vec_b_norm == 0)  // zero vector is pararrel to any vector.
-  {
-    return 0.0;
-  }
-  else
+  const int pts_size = static_cast<int>(raw_pts_vec_.size());
+  const int curvature_ssd_size = 2;
+  if (pts_size <= 2 * curvature_ssd_size)
   {
-    if (if_force_sharp_angle)
-    {
-      // return acos( abs( vec_a.dot( vec_b ) )*0.9999 / ( vec_a_norm * vec_b_norm ) );
-      return acos(abs(vec_a.dot(vec_b)) / (vec_a_norm * vec_b_norm));
-    }
-    else
-    {
-      // return acos( (vec_a.dot(vec_b))*0.9999 / (vec_a_norm*vec_b_norm));
-      return acos((vec_a.dot(vec_b)) / (vec_a_norm * vec_b_norm));
-    }
+    return;
   }
-}
-
-void LivoxMapper::computeFeatures()
-{
-  unsigned int pts_size = raw_pts_vec_.size();
-  size_t curvature_ssd_size = 2;
-  int critical_rm_point = e_pt_000 | e_pt_nan;
-  float neighbor_accumulate_xyz[3] = { 0.0, 0.0, 0.0 };
 
-  for (size_t idx = curvature_ssd_size; idx < pts_size - curvature_ssd_size; idx++)
-  {
-    if (pts_info_vec_[idx].pt_type_ & critical_rm_point)
+  // Split the scan line in contiguous coordinate arrays, so that the curvature window below vectorizes
+  pts_x_.resize(pts_size);
+  pts_y_.resize(pts_size);
+  pts_z_.resize(pts_size);
+  curvature_vec_.resize(pts_size);
+  for (int idx = 0; idx < pts_size; idx++)
+  {
+    pts_x_[idx] = raw_pts_vec_[idx].x_;
+    pts_y_[idx] = raw_pts_vec_[idx].y_;
+    pts_z_[idx] = raw_pts_vec_[idx].z_;
+  }
+
+  // Compute the curvature of every point along the scan line, as the squared norm of the sum of the differences to
+  // its two neighbors on each side
+  // - it is evaluated at once on the whole line with Eigen arrays, so that it runs on packed floats - the points
+  //   whose neighborhood holds invalid points are handled in the classification below
+  const int n = pts_size - 2 * curvature_ssd_size;
+  Eigen::Map<const Eigen::ArrayXf> x_line(pts_x_.data(), pts_size);
+  Eigen::Map<const Eigen::ArrayXf> y_line(pts_y_.data(), pts_size);
+  Eigen::Map<const Eigen::ArrayXf> z_line(pts_z_.data(), pts_size);
+  Eigen::Map<Eigen::ArrayXf> curvature(curvature_vec_.data() + curvature_ssd_size, n);
+  curvature =
+      ((x_line.segment(3, n) + x_line.segment(1, n)) + (x_line.segment(4, n) + x_line.segment(0, n)) -
+       4 * x_line.segment(2, n))
+          .square() +
+      ((y_line.segment(3, n) + y_line.segment(1, n)) + (y_line.segment(4, n) + y_line.segment(0, n)) -
+       4 * y_line.segment(2, n))
+          .square() +
+      ((z_line.segment(3, n) + z_line.segment(1, n)) + (z_line.segment(4, n) + z_line.segment(0, n)) -
+       4 * z_line.segment(2, n))
+          .square();
+
+  // Classify the points as corners or surfaces, from their curvature and the angle of the scan line to their ray
+  const float* x = pts_x_.data();
+  const float* y = pts_y_.data();
+  const float* z = pts_z_.data();
+  const int critical_rm_point = e_pt_000 | e_pt_nan;
+  const float max_cos_view_angle = std::cos(minimum_view_angle_ / 57.3);
+  const float sq2_diff = 0.1;
+  for (int idx = curvature_ssd_size; idx < pts_size - curvature_ssd_size; idx++)
+  {
+    Pt_infos& pt_info = pts_info_vec_[idx];
+    if (pt_info.pt_type_ & critical_rm_point)
     {
       continue;
     }
 
-    // Compute curvature
-    neighbor_accumulate_xyz[0] = 0.0;
-    neighbor_accumulate_xyz[1] = 0.0;
-    neighbor_accumulate_xyz[2] = 0.0;
-
-    for (size_t i = 1; i <= curvature_ssd_size; i++)
+    // A zero or infinite point right next to this one leaves it without curvature, and one further away invalidates it
+    bool near_critical = false;
+    for (int i = 1; i <= curvature_ssd_size && !near_critical; i++)
     {
-      if ((pts_info_vec_[idx + i].pt_type_ & e_pt_000) || (pts_info_vec_[idx - i].pt_type_ & e_pt_000))
+      int neighbors_type = pts_info_vec_[idx + i].pt_type_ | pts_info_vec_[idx - i].pt_type_;
+      if (neighbors_type & critical_rm_point)
       {
-        if (i == 1)
+        near_critical = true;
+        if (i > 1)
         {
-          pts_info_vec_[idx].pt_label_ |= e_label_near_zero;
+          pt_info.pt_label_ = e_label_invalid;
         }
         else
         {
-          pts_info_vec_[idx].pt_label_ = e_label_invalid;
+          pt_info.pt_label_ |= (neighbors_type & e_pt_000) ? e_label_near_zero : e_label_near_nan;
         }
-        break;
-      }
-      else if ((pts_info_vec_[idx + i].pt_type_ & e_pt_nan) || (pts_info_vec_[idx - i].pt_type_ & e_pt_nan))
-      {
-        if (i == 1)
-        {
-          pts_info_vec_[idx].pt_label_ |= e_label_near_nan;
-        }
-        else
-        {
-          pts_info_vec_[idx].pt_label_ = e_label_invalid;
-        }
-        break;
-      }
-      else
-      {
-        neighbor_accumulate_xyz[0] += raw_pts_vec_[idx + i].x_ + raw_pts_vec_[idx - i].x_;
-        neighbor_accumulate_xyz[1] += raw_pts_vec_[idx + i].y_ + raw_pts_vec_[idx - i].y_;
-        neighbor_accumulate_xyz[2] += raw_pts_vec_[idx + i].z_ + raw_pts_vec_[idx - i].z_;
       }
     }
-
-    if (pts_info_vec_[idx].pt_label_ == e_label_invalid)
+    if (pt_info.pt_label_ == e_label_invalid)
     {
       continue;
     }
+    float pt_sq2 = x[idx] * x[idx] + y[idx] * y[idx] + z[idx] * z[idx];
+    pt_info.curvature_ = near_critical ? 16 * pt_sq2 : curvature_vec_[idx];
 
-    neighbor_accumulate_xyz[0] -= curvature_ssd_size * 2 * raw_pts_vec_[idx].x_;
-    neighbor_accumulate_xyz[1] -= curvature_ssd_size * 2 * raw_pts_vec_[idx].y_;
-    neighbor_accumulate_xyz[2] -= curvature_ssd_size * 2 * raw_pts_vec_[idx].z_;
-    pts_info_vec_[idx].curvature_ = neighbor_accumulate_xyz[0] * neighbor_accumulate_xyz[0] +
-                                    neighbor_accumulate_xyz[1] * neighbor_accumulate_xyz[1] +
-                                    neighbor_accumulate_xyz[2] * neighbor_accumulate_xyz[2];
+    // Compute plane angle, between the ray of the point and the scan line through it
+    float line_x = x[idx + curvature_ssd_size] - x[idx - curvature_ssd_size];
+    float line_y = y[idx + curvature_ssd_size] - y[idx - curvature_ssd_size];
+    float line_z = z[idx + curvature_ssd_size] - z[idx - curvature_ssd_size];
+    float ray_dot_line = x[idx] * line_x + y[idx] * line_y + z[idx] * line_z;
+    float line_sq2 = line_x * line_x + line_y * line_y + line_z * line_z;
+    float norms = std::sqrt(pt_sq2 * line_sq2);
+    float cos_view_angle = (norms == 0) ? 1.f : std::fabs(ray_dot_line) / norms;
+    pt_info.view_angle_ = (norms == 0) ? 0.f : std::acos(std::min(cos_view_angle, 1.f)) * 57.3;
 
-    // Compute plane angle
-    Eigen::Matrix<float, 3, 1> vec_a(raw_pts_vec_[idx].x_, raw_pts_vec_[idx].y_, raw_pts_vec_[idx].z_);
-    Eigen::Matrix<float, 3, 1> vec_b(
-        raw_pts_vec_[idx + curvature_ssd_size].x_ - raw_pts_vec_[idx - curvature_ssd_size].x_,
-        raw_pts_vec_[idx + curvature_ssd_size].y_ - raw_pts_vec_[idx - curvature_ssd_size].y_,
-        raw_pts_vec_[idx + curvature_ssd_size].z_ - raw_pts_vec_[idx - curvature_ssd_size].z_);
-    pts_info_vec_[idx].view_angle_ = vector_angle(vec_a, vec_b, 1) * 57.3;
-
-    if (pts_info_vec_[idx].view_angle_ > minimum_view_angle_)
+    if (cos_view_angle >= max_cos_view_angle)
     {
-      if (pts_info_vec_[idx].curvature_ < thr_surface_curvature_)
-      {
-        pts_info_vec_[idx].pt_label_ |= e_label_surface;
-      }
-
-      float sq2_diff = 0.1;
+      continue;
+    }
 
-      if (pts_info_vec_[idx].curvature_ > thr_corner_curvature_)
+    if (pt_info.curvature_ < thr_surface_curvature_)
+    {
+      pt_info.pt_label_ |= e_label_surface;
+    }
+    else if (pt_info.curvature_ > thr_corner_curvature_)
+    {
+      // Corners must lie in front of their neighbors, at a similar depth to at least one of them
+      const float& depth_sq2 = pt_info.depth_sq2_;
+      const float& prev_depth_sq2 = pts_info_vec_[idx - curvature_ssd_size].depth_sq2_;
+      const float& next_depth_sq2 = pts_info_vec_[idx + curvature_ssd_size].depth_sq2_;
+      if (depth_sq2 <= prev_depth_sq2 && depth_sq2 <= next_depth_sq2 &&
+          (std::fabs(depth_sq2 - prev_depth_sq2) < sq2_diff * depth_sq2 ||
+           std::fabs(depth_sq2 - next_depth_sq2) < sq2_diff * depth_sq2))
       {
-        if (pts_info_vec_[idx].depth_sq2_ <= pts_info_vec_[idx - curvature_ssd_size].depth_sq2_ &&
-            pts_info_vec_[idx].depth_sq2_ <= pts_info_vec_[idx + curvature_ssd_size].depth_sq2_)
-        {
-          if (abs(pts_info_vec_[idx].depth_sq2_ - pts_info_vec_[idx - curvature_ssd_size].depth_sq2_) <
-                  sq2_diff * pts_info_vec_[idx].depth_sq2_ ||
-              abs(pts_info_vec_[idx].depth_sq2_ - pts_info_vec_[idx + curvature_ssd_size].depth_sq2_) <
-                  sq2_diff * pts_info_vec_[idx].depth_sq2_)
-            pts_info_vec_[idx].pt_label_ |= e_label_corner;
-        }
+        pt_info.pt_label_ |= e_label_corner;
       }
     }
   }
@@ -1948,8 +2351,6 @@ int LivoxMapper::projectionScan3d2d(const std::vector<Point>& laser_cloud_in, st
   std::vector<int> edge_idx;
   std::vector<int> split_idx;
   scan_id_index.resize(pts_size);
-  map_pt_idx_.clear();
-  map_pt_idx_.reserve(pts_size);
   std::vector<int> zero_idx;
 
   input_points_size_ = 0;
@@ -1958,7 +2359,6 @@ int LivoxMapper::projectionScan3d2d(const std::vector<Point>& laser_cloud_in, st
   {
     raw_pts_vec_[idx] = laser_cloud_in[idx];
     Pt_infos* pt_info = &pts_info_vec_[idx];
-    map_pt_idx_.insert(std::make_pair(laser_cloud_in[idx], pt_info));
     pt_info->raw_intensity_ = laser_cloud_in[idx].intensity_;
     pt_info->idx_ = idx;
     pt_info->time_stamp_ = current_time_ + ((float)idx) * time_internal_pts_;
@@ -1992,8 +2392,6 @@ int LivoxMapper::projectionScan3d2d(const std::vector<Point>& laser_cloud_in, st
       }
     }
 
-    map_pt_idx_.insert(std::make_pair(laser_cloud_in[idx], pt_info));
-
     pt_info->depth_sq2_ = laser_cloud_in[idx].norm3D();
 
     pt_info->pt_2d_img_ << laser_cloud_in[idx].y_ / laser_cloud_in[idx].x_,
@@ -2096,56 +2494,48 @@ void LivoxMapper::splitLaserScan(const int clutter_size, const std::vector<Point
                                  const std::vector<float>& scan_id_index,
                                  std::vector<std::vector<Point>>& laser_cloud_scans)
 {
-  std::vector<std::vector<int>> pts_mask;
-  laser_cloud_scans.resize(clutter_size);
-  pts_mask.resize(clutter_size);
-  Point point;
+  // The points of each scan are kept by their index in the input cloud, that is also the index of their info
+  std::vector<std::vector<int>> scans_pts_idx;
+  scans_pts_idx.resize(clutter_size);
   int scan_idx = 0;
 
   for (unsigned int i = 0; i < laser_cloud_in.size(); i++)
   {
-    point = laser_cloud_in[i];
-
     if (i > 0 && ((scan_id_index[i]) != (scan_id_index[i - 1])))
     {
       scan_idx = scan_idx + 1;
-      pts_mask[scan_idx].reserve(5000);
+      scans_pts_idx[scan_idx].reserve(5000);
     }
 
-    laser_cloud_scans[scan_idx].push_back(point);
-    pts_mask[scan_idx].push_back(pts_info_vec_[i].pt_type_);
+    scans_pts_idx[scan_idx].push_back(static_cast<int>(i));
   }
-  laser_cloud_scans.resize(scan_idx);
+  scans_pts_idx.resize(scan_idx);
 
   int remove_point_pt_type_ = e_pt_000 | e_pt_too_near | e_pt_nan;
-  int scan_avail_num = 0;
-  std::vector<std::vector<Point>> res_laser_cloud_scan;
-  for (unsigned int i = 0; i < laser_cloud_scans.size(); i++)
+  laser_cloud_scans.clear();
+  for (const auto& scan_pts_idx : scans_pts_idx)
   {
-    scan_avail_num = 0;
     std::vector<Point> laser_clour_per_scan;
-    for (unsigned int idx = 0; idx < laser_cloud_scans[i].size(); idx++)
+    for (const auto& idx : scan_pts_idx)
     {
-      if ((pts_mask[i][idx] & remove_point_pt_type_) == 0)
+      if ((pts_info_vec_[idx].pt_type_ & remove_point_pt_type_) == 0)
       {
-        if (laser_cloud_scans[i][idx].x_ == 0)
+        if (laser_cloud_in[idx].x_ == 0)
         {
-          assert(laser_cloud_scans[i][idx].x_ != 0);
+          assert(laser_cloud_in[idx].x_ != 0);
           continue;
         }
-        auto temp_pt = laser_cloud_scans[i][idx];
-        setIntensity(temp_pt, default_return_intensity_type_);
+        auto temp_pt = laser_cloud_in[idx];
+        setIntensity(temp_pt, pts_info_vec_[idx], default_return_intensity_type_);
         laser_clour_per_scan.push_back(temp_pt);
-        scan_avail_num++;
       }
     }
 
-    if (scan_avail_num)
+    if (!laser_clour_per_scan.empty())
     {
-      res_laser_cloud_scan.push_back(laser_clour_per_scan);
+      laser_cloud_scans.push_back(laser_clour_per_scan);
     }
   }
-  laser_cloud_scans = res_laser_cloud_scan;
 }
 
 std::vector<std::vector<Point>> LivoxMapper::extractLaserFeatures(const std::vector<Point>& laser_cloud_in,
@@ -2168,7 +2558,6 @@ std::vector<std::vector<Point>> LivoxMapper::extractLaserFeatures(const std::vec
   std::vector<std::vector<Point>> laser_cloud_scans, temp_laser_scans;
   std::vector<float> scan_id_index;
   laser_cloud_scans.clear();
-  map_pt_idx_.clear();
   pts_info_vec_.clear();
   raw_pts_vec_.clear();
 
@@ -2194,43 +2583,126 @@ std::vector<std::vector<Point>> LivoxMapper::extractLaserFeatures(const std::vec
   }
 }
 
-void LivoxMapper::flatGroundRemoval(const std::vector<Point>& in_pts, Plane& out_pcl)
+void LivoxMapper::fovBinProjection(const std::vector<Point>& in_pts)
 {
-  // _ground_mat
-  // -1, no valid info to check if ground of not
-  //  0, initial value, after validation, means not ground
-  //  1, ground
-  for (int j = 0; j < horizontal_scans_; j++)
+  const int n_bins = fov_bins_ * fov_bins_;
+  pt_bins_.resize(in_pts.size());
+  bin_offsets_.assign(n_bins + 1, 0);
+
+  // Find the bin of each point, from its azimuth and elevation around the main axis of the sensor, and count the
+  // points of each bin
+  for (size_t i = 0; i < in_pts.size(); i++)
   {
-    for (int i = 0; i < ground_scan_idx_; i++)
+    const Point& pt = in_pts[i];
+    pt_bins_[i] = -1;
+
+    float range = pt.norm3D();
+    if (!(range > 0.) || range > 50.0 || (std::fabs(pt.x_) < 0.9 && std::fabs(pt.y_) < 0.4))
+    {
+      continue;
+    }
+
+    float horizon_angle = std::atan2(pt.y_, pt.x_);
+    float vertical_angle = std::atan2(pt.z_, std::sqrt(pt.x_ * pt.x_ + pt.y_ * pt.y_));
+    int column_idx = static_cast<int>(std::floor((horizon_angle + fov_half_angle_) / fov_bin_res_));
+    int row_idx = static_cast<int>(std::floor((vertical_angle + fov_half_angle_) / fov_bin_res_));
+    if (column_idx < 0 || column_idx >= fov_bins_ || row_idx < 0 || row_idx >= fov_bins_)
     {
-      int lower_idx = j + i * horizontal_scans_;
-      int upper_idx = j + (i + 1) * horizontal_scans_;
+      continue;
+    }
 
-      Point upper_pt = in_pts[upper_idx];
-      Point lower_pt = in_pts[lower_idx];
+    pt_bins_[i] = column_idx + row_idx * fov_bins_;
+    bin_offsets_[pt_bins_[i] + 1]++;
+  }
 
-      //      if (range_mat_(i, j) == -1 || range_mat_(i + 1, j) == -1)
-      //      {
-      //        // no info to check, invalid points
-      //        //        ground_mat_(i, j) = -1;
-      //        continue;
-      //      }
+  // Turn the counts into the offset of the first point of each bin
+  for (int bin = 0; bin < n_bins; bin++)
+  {
+    bin_offsets_[bin + 1] += bin_offsets_[bin];
+  }
 
-      float dX = upper_pt.x_ - lower_pt.x_;
-      float dY = upper_pt.y_ - lower_pt.y_;
-      float dZ = upper_pt.z_ - lower_pt.z_;
+  // Store the points of each bin contiguously, keeping track of the closest one
+  bin_pts_.resize(bin_offsets_[n_bins]);
+  bin_fill_.assign(bin_offsets_.begin(), bin_offsets_.end() - 1);
+  bin_closest_.assign(n_bins, -1);
+  for (size_t i = 0; i < in_pts.size(); i++)
+  {
+    const int& bin = pt_bins_[i];
+    if (bin == -1)
+    {
+      continue;
+    }
+
+    int slot = bin_fill_[bin]++;
+    bin_pts_[slot] = in_pts[i];
+    if (bin_closest_[bin] == -1 || bin_pts_[slot].norm3D() < bin_pts_[bin_closest_[bin]].norm3D())
+    {
+      bin_closest_[bin] = slot;
+    }
+  }
+
+  bin_closest_pts_.clear();
+  for (int bin = 0; bin < n_bins; bin++)
+  {
+    if (bin_closest_[bin] != -1)
+    {
+      bin_closest_pts_.push_back(bin_pts_[bin_closest_[bin]]);
+    }
+  }
+}
 
-      float vertical_angle = std::atan2(dZ, std::sqrt(dX * dX + dY * dY + dZ * dZ));
+void LivoxMapper::flatGroundRemoval(Plane& out_pcl)
+{
+  // Walk up each column of bins below the horizon, comparing the closest points of consecutive non empty bins
+  // - the scan pattern leaves holes in the grid, so bins up to ground_bin_gap_ rows apart are still compared
+  const int n_bins = fov_bins_ * fov_bins_;
+  std::vector<bool> ground_bins(n_bins, false);
+  for (int j = 0; j < fov_bins_; j++)
+  {
+    int lower_i = -1;
+    for (int i = 0; i < fov_bins_ / 2; i++)
+    {
+      int upper_bin = j + i * fov_bins_;
+      if (bin_closest_[upper_bin] == -1)
+      {
+        continue;
+      }
 
-      if (vertical_angle <= ground_th_ && std::fabs(lower_pt.z_) > lidar_height_ / 2 &&
-          std::fabs(upper_pt.z_) > lidar_height_ / 2)
+      int lower_bin = j + lower_i * fov_bins_;
+      if (lower_i != -1 && i - lower_i <= ground_bin_gap_)
       {
-        out_pcl.points_.push_back(lower_pt);
-        out_pcl.points_.push_back(upper_pt);
-        out_pcl.indexes_.emplace_back(i, j);
-        out_pcl.indexes_.emplace_back(i + 1, j);
+        const Point& upper_pt = bin_pts_[bin_closest_[upper_bin]];
+        const Point& lower_pt = bin_pts_[bin_closest_[lower_bin]];
+
+        float dX = upper_pt.x_ - lower_pt.x_;
+        float dY = upper_pt.y_ - lower_pt.y_;
+        float dZ = upper_pt.z_ - lower_pt.z_;
+
+        float vertical_angle = std::atan2(dZ, std::sqrt(dX * dX + dY * dY + dZ * dZ));
+
+        if (vertical_angle <= ground_th_ && std::fabs(lower_pt.z_) > lidar_height_ / 2 &&
+            std::fabs(upper_pt.z_) > lidar_height_ / 2)
+        {
+          ground_bins[lower_bin] = true;
+          ground_bins[upper_bin] = true;
+        }
       }
+      lower_i = i;
+    }
+  }
+
+  // All the points of the ground bins are ground candidates
+  for (int bin = 0; bin < n_bins; bin++)
+  {
+    if (!ground_bins[bin])
+    {
+      continue;
+    }
+
+    for (int slot = bin_offsets_[bin]; slot < bin_offsets_[bin + 1]; slot++)
+    {
+      out_pcl.points_.push_back(bin_pts_[slot]);
+      out_pcl.indexes_.emplace_back(bin / fov_bins_, bin % fov_bins_);
     }
   }
 }
@@ -2240,7 +2712,7 @@ void LivoxMapper::extractHighLevelPlanes(const std::vector<Point>& in_pts, const
 {
   Tf tf;
   std::array<float, 9> tf_rot{};
-  prev_robot_pose_.toRotMatrix(tf_rot);
+  prevRobotPose().toRotMatrix(tf_rot);
   tf = Tf(tf_rot, std::array<float, 3>{ 0, 0, 0 });
 
   // Remove ground and null points from the set of input points
@@ -2285,14 +2757,14 @@ void LivoxMapper::extractHighLevelPlanes(const std::vector<Point>& in_pts, const
   // - Remove outliers using RANSAC
   std::vector<Plane> planes = {};
   Plane side_plane_a_filtered, side_plane_b_filtered;
-  if (Ransac::process(side_plane_a.points_, side_plane_a_filtered, 300, 0.10, true) &&
+  if (Ransac::processAdaptive(side_plane_a.points_, side_plane_a_filtered, 300, 0.10, true) &&
       side_plane_a_filtered.points_.size() < 7000 &&
       side_plane_a_filtered.points_.size() > 75)  // prevent dense planes and slow convex hulls
   {
     side_plane_a_filtered.id_ = 0;
     planes.push_back(side_plane_a_filtered);
   }
-  if (Ransac::process(side_plane_b.points_, side_plane_b_filtered, 300, 0.10, true) &&
+  if (Ransac::processAdaptive(side_plane_b.points_, side_plane_b_filtered, 300, 0.10, true) &&
       side_plane_b_filtered.points_.size() < 7000 &&
       side_plane_b_filtered.points_.size() > 75)  // prevent dense planes and slow convex hulls
   {
@@ -20,6 +20,7 @@
 #include <vineslam/map_io/elevation_map_parser.hpp>
 #include <vineslam/utils/save_data.hpp>
 #include <vineslam/utils/Timer.hpp>
+#include <vineslam/utils/SPSCQueue.hpp>
 // ----------------------------
 #include <vineslam_ros/srv/save_map.hpp>
 // ----------------------------
@@ -29,8 +30,12 @@
 // std
 #include <iostream>
 #include <chrono>
+#include <cstring>
 #include <ctime>
 #include <iomanip>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
 #include <thread>
 
 // ROS
@@ -64,8 +69,6 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/highgui.hpp>
 
-#define LIDAR_VERSION 0  // 0 -> velodyne, 1 -> livox
-
 namespace vineslam
 {
 class VineSLAM_ros : public rclcpp::Node
@@ -75,12 +78,14 @@ public:
   VineSLAM_ros(const std::string& node) : Node(node)
   {
   }
+  // Class destructor - stops the workers of the additional LiDARs
+  ~VineSLAM_ros() override;
 
   // Landmark detection callback function
   void landmarkListener(const vision_msgs::msg::Detection2DArray::SharedPtr dets);
 
-  // Scan callback function
-  void scanListener(const sensor_msgs::msg::PointCloud2::SharedPtr msg);
+  // Scan callback function - takes the scans of the LiDAR lidar_idx
+  void scanListener(const sensor_msgs::msg::PointCloud2::SharedPtr msg, const size_t& lidar_idx);
 
   // Odometry callback function
   void odomListener(const nav_msgs::msg::Odometry::SharedPtr msg);
@@ -174,9 +179,6 @@ public:
     Pose imu_pose_;
     Pose imu_data_pose_;
 
-    // LiDAR scan points
-    std::vector<Point> scan_pts_;
-
     // Observation flags
     bool received_landmarks_;
     bool received_odometry_;
@@ -184,7 +186,103 @@ public:
     bool received_scans_;
   } input_data_;
 
-  // ROS publishers/services
+  // Local maps of a scan, along with the other inputs as they were when it was taken
+  struct ScanFrame
+  {
+    // Most recent message header
+    std_msgs::msg::Header header_;
+    // LiDAR local maps
+    std::vector<Corner> corners_;
+    std::vector<Planar> planars_;
+    std::vector<SemiPlane> planes_;
+    SemiPlane ground_plane_;
+    // Wheel odometry pose
+    Pose wheel_odom_pose_;
+    // GNSS pose
+    Pose gnss_pose_;
+    // IMU poses - the gyroscope integration is taken, and restarted, with the scan
+    Pose imu_pose_;
+    Pose imu_data_pose_;
+    // Landmark observations
+    std::vector<int> land_labels_;
+    std::vector<float> land_bearings_;
+    std::vector<float> land_pitches_;
+    // Main LiDAR scan points - only kept if the logs are saved
+    std::vector<Point> scan_pts_;
+  } scan_frame_;
+
+  // Builds the local maps of the current scan, and takes a snapshot of the other inputs
+  void buildFrame(ScanFrame& frame, Timer& timer);
+
+  // Splits the worker threads between the thread pools that run at the same time - the one of the particle filter,
+  // that takes the first share, and the one of each Velodyne mapper
+  // - the pools only overlap with the pipelined front end or with additional LiDARs, otherwise they are not split
+  void splitThreadPools();
+  // Builds a mapper for each LiDAR, subscribes to its scans, and waits for its transformation to the base_link
+  // - the main LiDAR is subscribed on /scan_topic, and the additional ones on /scan_topic_1, /scan_topic_2, ...
+  void initLidars(tf2_ros::Buffer& tf_buffer);
+  // Builds the local maps of the latest scans of all the LiDARs, merged on the base_link referential frame
+  // - the local map of each additional LiDAR is built by its worker, while the main one is built in this thread
+  // - the scans of the additional LiDARs are only merged once, and only if they are not older than the main scan
+  //   by more than a scan period
+  // - the ground plane with more points is kept
+  void lidarLocalMap(std::vector<Corner>& out_corners, std::vector<Planar>& out_planars,
+                     std::vector<SemiPlane>& out_planes, SemiPlane& out_ground_plane);
+
+  // Builds the local map of a single scan
+  void scanLocalMap(LidarMapper* mapper, const LidarScan& scan, std::vector<Corner>& out_corners,
+                    std::vector<Planar>& out_planars, std::vector<SemiPlane>& out_planes, SemiPlane& out_ground_plane);
+
+  // Latest scan of a LiDAR, handed over from its listener under the lock
+  // - the listener parses each message into its own buffer, that is then swapped with the latest scan
+  struct ScanSlot
+  {
+    std::mutex mutex_;
+    LidarScan scan_;
+    LidarScan parsed_;
+    bool new_scan_{};
+  };
+  // Takes the latest scan of a LiDAR into scan, if there is a new one - returns false otherwise
+  bool takeScan(ScanSlot& slot, LidarScan& scan);
+  std::vector<std::unique_ptr<ScanSlot>> scan_slots_;
+  // Scan of the main LiDAR from which the last local map was built
+  LidarScan main_scan_;
+  double prev_main_time_stamp_{};
+
+  // Long-lived worker of an additional LiDAR, that builds the local map of its latest scan on request
+  struct LidarWorker
+  {
+    std::thread thread_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool requested_{};
+    bool done_{};
+    bool stop_{};
+    // Oldest scan time stamp accepted by the current request
+    double min_time_stamp_{};
+    // Scan in process, and time stamp of the last one merged
+    LidarScan scan_;
+    double last_time_stamp_{ -1 };
+    // Local map of the current request - only valid if a new scan was taken
+    ScanFrame frame_;
+    bool valid_{};
+  };
+  void lidarWorker(const size_t& lidar_idx);
+  std::vector<std::unique_ptr<LidarWorker>> lidar_workers_;
+
+  // Pipelined execution - the local maps of each scan are built in a front end thread, while the main loop processes
+  // the previous scan, so that the throughput is set by the slowest of the two stages instead of by their sum
+  // - the front end only takes the scans that come after a GNSS fix if wait_for_gnss is set
+  void frontEnd(const bool& wait_for_gnss);
+  // Launches the front end thread, the first time, and takes the next frame it built into scan_frame_ - returns
+  // false if there is none yet
+  bool nextFrame(const bool& wait_for_gnss);
+  // Frames handed over from the front end thread to the main loop
+  SPSCQueue<ScanFrame, 1> scan_frames_;
+  bool front_end_launched_{};
+
+  // ROS subscribers/publishers/services
+  std::vector<rclcpp::Subscription<sensor_msgs::msg::PointCloud2>::SharedPtr> scan_subscribers_;
   rclcpp::Publisher<sensor_msgs::msg::PointCloud2>::SharedPtr processed_occ_grid_publisher_;
   rclcpp::Publisher<visualization_msgs::msg::MarkerArray>::SharedPtr topological_map_publisher_;
   rclcpp::Publisher<visualization_msgs::msg::MarkerArray>::SharedPtr grid_map_publisher_;
@@ -211,11 +309,9 @@ public:
   OccupancyMap* grid_map_;
   TopologicalMap* topological_map_;
   LandmarkMapper* land_mapper_;
-#if LIDAR_SENSOR == 0
-  VelodyneMapper* lid_mapper_;
-#elif LIDAR_SENSOR == 1
-  LivoxMapper* lid_mapper_;
-#endif
+  // - LiDAR mappers, one per sensor, and the one of the main LiDAR, that registers the maps
+  std::vector<LidarMapper*> lid_mappers_;
+  LidarMapper* lid_mapper_;
   Timer* timer_;
   Geodetic* geodetic_converter_;
   Observation obsv_;
@@ -22,6 +22,8 @@ HybridNode::HybridNode() : VineSLAM_ros("HybridNode")
 {
   // Load params
   loadParameters(params_);
+  splitThreadPools();
+  Rng::setGlobalSeed(params_.random_seed_);
 
   // Set initialization flags default values
   init_flag_ = true;
@@ -34,17 +36,8 @@ HybridNode::HybridNode() : VineSLAM_ros("HybridNode")
   // Declare the Mappers and Localizer objects
   localizer_ = new Localizer(params_);
   land_mapper_ = new LandmarkMapper(params_);
-#if LIDAR_SENSOR == 0
-  lid_mapper_ = new VelodyneMapper(params_);
-#elif LIDAR_SENSOR == 1
-  lid_mapper_ = new LivoxMapper(params_);
-#endif
   timer_ = new Timer("VineSLAM subfunctions");
 
-  // Scan subscription
-  scan_subscriber_ = this->create_subscription<sensor_msgs::msg::PointCloud2>(
-      "/scan_topic", 10,
-      std::bind(&VineSLAM_ros::scanListener, dynamic_cast<VineSLAM_ros*>(this), std::placeholders::_1));
   // Odometry subscription
   odom_subscriber_ = this->create_subscription<nav_msgs::msg::Odometry>(
       "/odom_topic", 10,
@@ -90,8 +83,8 @@ HybridNode::HybridNode() : VineSLAM_ros("HybridNode")
   RCLCPP_INFO(this->get_logger(), "Waiting for static transforms...");
   tf2_ros::Buffer tf_buffer(this->get_clock());
   tf2_ros::TransformListener tfListener(tf_buffer);
-  geometry_msgs::msg::TransformStamped cam2base_msg, laser2base_msg;
-  bool got_cam2base = false, got_laser2base = false;
+  geometry_msgs::msg::TransformStamped cam2base_msg;
+  bool got_cam2base = false;
   while (!got_cam2base && rclcpp::ok())
   {
     try
@@ -106,20 +99,8 @@ HybridNode::HybridNode() : VineSLAM_ros("HybridNode")
     }
     got_cam2base = true;
   }
-  while (!got_laser2base && rclcpp::ok())
-  {
-    try
-    {
-      laser2base_msg = tf_buffer.lookupTransform(params_.lidar_sensor_frame_, "base_link", rclcpp::Time(0));
-    }
-    catch (tf2::TransformException& ex)
-    {
-      RCLCPP_WARN(this->get_logger(), "%s", ex.what());
-      rclcpp::sleep_for(std::chrono::nanoseconds(1000000000));
-      continue;
-    }
-    got_laser2base = true;
-  }
+  // LiDAR mappers, scan subscriptions and transforms
+  initLidars(tf_buffer);
   RCLCPP_INFO(this->get_logger(), "Received!");
 
   // Save tfs
@@ -132,15 +113,6 @@ HybridNode::HybridNode() : VineSLAM_ros("HybridNode")
   cam2base.getBasis().getRPY(roll, pitch, yaw);
   cam2base_tf_ = Pose(t.getX(), t.getY(), t.getZ(), roll, pitch, yaw).toTf();
 
-  tf2::Stamped<tf2::Transform> laser2base_stamped;
-  tf2::fromMsg(laser2base_msg, laser2base_stamped);
-
-  tf2::Transform laser2base = laser2base_stamped;  //.inverse();
-  t = laser2base.getOrigin();
-  laser2base.getBasis().getRPY(roll, pitch, yaw);
-
-  lid_mapper_->setLaser2Base(t.getX(), t.getY(), t.getZ(), roll, pitch, yaw);
-
   // Initialize tf broadcaster
   tf_broadcaster_ = std::make_shared<tf2_ros::TransformBroadcaster>(this);
 
@@ -203,12 +175,99 @@ void HybridNode::loadParameters(Parameters& params)
   {
     RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
   }
+  param = prefix + ".lidar_sensor";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_sensor_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
   param = prefix + ".lidar_sensor_frame";
   this->declare_parameter(param);
   if (!this->get_parameter(param, params.lidar_sensor_frame_))
   {
     RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
   }
+  param = prefix + ".lidar_model";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_model_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".lidar_height";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_height_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".lidar_segmentation";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_segmentation_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".lidar_plane_extraction";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_plane_extraction_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".lidar_voxel_size";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_voxel_size_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".lidar_voxel_centroid";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_voxel_centroid_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".livox_fov_half_angle";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.livox_fov_half_angle_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".livox_fov_bin_res";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.livox_fov_bin_res_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  int n_extra_lidars = 0;
+  param = prefix + ".extra_lidars.number";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, n_extra_lidars))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  for (int i = 1; i <= n_extra_lidars; i++)
+  {
+    std::string lidar_prefix = prefix + ".extra_lidars.lidar_" + std::to_string(i);
+    std::string sensor = "velodyne", sensor_frame, model = "vlp16";
+    param = lidar_prefix + ".sensor";
+    this->declare_parameter(param);
+    if (!this->get_parameter(param, sensor))
+    {
+      RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+    }
+    param = lidar_prefix + ".sensor_frame";
+    this->declare_parameter(param);
+    if (!this->get_parameter(param, sensor_frame))
+    {
+      RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+    }
+    param = lidar_prefix + ".model";
+    this->declare_parameter(param);
+    if (!this->get_parameter(param, model))
+    {
+      RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+    }
+    params.extra_lidar_sensors_.push_back(sensor);
+    params.extra_lidar_frames_.push_back(sensor_frame);
+    params.extra_lidar_models_.push_back(model);
+  }
   param = prefix + ".use_semantic_features";
   this->declare_parameter(param);
   if (!this->get_parameter(param, params.use_semantic_features_))
@@ -365,6 +424,24 @@ void HybridNode::loadParameters(Parameters& params)
   {
     RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
   }
+  param = prefix + ".multithreading.num_threads";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.num_threads_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".multithreading.reserved_cores";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.reserved_cores_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".multithreading.pin_threads";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.pin_threads_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
   param = prefix + ".pf.n_particles";
   this->declare_parameter(param);
   if (!this->get_parameter(param, params.number_particles_))
@@ -407,6 +484,54 @@ void HybridNode::loadParameters(Parameters& params)
   {
     RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
   }
+  param = prefix + ".pf.random_seed";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.random_seed_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.parallel_resampling";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.parallel_resampling_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.time_budget";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.time_budget_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.fine_particles";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.fine_particles_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.coarse_subsampling";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.coarse_subsampling_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.reduced_state";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.reduced_state_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.async_updates";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.async_updates_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.async_resampling_neff";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.async_resampling_neff_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
 }
 
 void HybridNode::loop()
@@ -468,6 +593,7 @@ void HybridNode::init()
   // ----- Initialize the localizer and get first particles distribution
   // ---------------------------------------------------------
   localizer_->init(robot_pose_);
+  localizer_->setElevationMap(elevation_map_);
   robot_pose_ = localizer_->getPose();
 
   // ---------------------------------------------------------
@@ -488,25 +614,7 @@ void HybridNode::init()
   SemiPlane l_ground_plane;
   if (params_.use_lidar_features_)
   {
-#if LIDAR_SENSOR == 0
-    if (params_.use_vertical_planes_)
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, l_corners, l_planars, l_planes, l_ground_plane);
-    }
-    else
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, l_corners, l_planars, l_ground_plane);
-    }
-#elif LIDAR_SENSOR == 1
-    if (params_.use_vertical_planes_)
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, header_.stamp.sec, l_corners, l_planars, l_planes, l_ground_plane);
-    }
-    else
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, header_.stamp.sec, l_corners, l_planars, l_ground_plane);
-    }
-#endif
+    lidarLocalMap(l_corners, l_planars, l_planes, l_ground_plane);
   }
 
   // Create logs file if desired
@@ -586,25 +694,7 @@ void HybridNode::process()
   if (params_.use_lidar_features_)
   {
     timer_->tick("lidar_mapper::localMap()");
-#if LIDAR_SENSOR == 0
-    if (params_.use_vertical_planes_)
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, l_corners, l_planars, l_planes, l_ground_plane);
-    }
-    else
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, l_corners, l_planars, l_ground_plane);
-    }
-#elif LIDAR_SENSOR == 1
-    if (params_.use_vertical_planes_)
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, header_.stamp.sec, l_corners, l_planars, l_planes, l_ground_plane);
-    }
-    else
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, header_.stamp.sec, l_corners, l_planars, l_ground_plane);
-    }
-#endif
+    lidarLocalMap(l_corners, l_planars, l_planes, l_ground_plane);
     timer_->tock();
   }
 
@@ -646,7 +736,7 @@ void HybridNode::process()
   computeInnovation(odom_inc, input_data_.imu_data_pose_, innovation);
 
   timer_->tick("localizer::process()");
-  localizer_->process(innovation, obsv_, grid_map_);
+  localizer_->process(innovation, obsv_, grid_map_, params_.time_budget_);
   robot_pose_ = localizer_->getPose();
   timer_->tock();
 
@@ -681,6 +771,10 @@ void HybridNode::process()
       timer_->tick("lidar_mapper::registerMaps()");
       lid_mapper_->registerMaps(robot_pose_, l_corners, l_planars, l_planes, l_ground_plane, *grid_map_,
                                 *elevation_map_);
+      for (size_t i = 1; i < lid_mappers_.size(); i++)
+      {
+        lid_mappers_[i]->setPrevRobotPose(robot_pose_);
+      }
       timer_->tock();
 
       timer_->tick("grid_map::downsamplePlanars()");
@@ -708,10 +802,12 @@ void HybridNode::process()
   if (params_.use_lidar_features_)
   {
     std::vector<Point> rectangle;
-#if LIDAR_SENSOR == 0
-    lid_mapper_->computeUnoccupiedZone(input_data_.scan_pts_, rectangle);
-    lid_mapper_->filterWithinZone(robot_pose_, rectangle, *grid_map_);
-#endif
+    auto* velodyne_mapper = dynamic_cast<VelodyneMapper*>(lid_mapper_);
+    if (velodyne_mapper != nullptr)
+    {
+      velodyne_mapper->computeUnoccupiedZone(main_scan_.pts_, rectangle);
+      velodyne_mapper->filterWithinZone(robot_pose_, rectangle, *grid_map_);
+    }
     publishUnoccupiedZone(rectangle);
   }
 
@@ -754,7 +850,7 @@ void HybridNode::process()
 
     // Save the pcl file
     pcl::PointCloud<pcl::PointXYZI> cloud;
-    for (const auto& pt : input_data_.scan_pts_)
+    for (const auto& pt : main_scan_.pts_)
     {
       pcl::PointXYZI pcl_pt;
       pcl_pt.x = pt.x_;
@@ -863,25 +959,7 @@ void HybridNode::iMenuCallback(const visualization_msgs::msg::InteractiveMarkerF
     SemiPlane l_ground_plane;
     if (params_.use_lidar_features_)
     {
-#if LIDAR_SENSOR == 0
-      if (params_.use_vertical_planes_)
-      {
-        lid_mapper_->localMap(input_data_.scan_pts_, l_corners, l_planars, l_planes, l_ground_plane);
-      }
-      else
-      {
-        lid_mapper_->localMap(input_data_.scan_pts_, l_corners, l_planars, l_ground_plane);
-      }
-#elif LIDAR_SENSOR == 1
-      if (params_.use_vertical_planes_)
-      {
-        lid_mapper_->localMap(input_data_.scan_pts_, header_.stamp.sec, l_corners, l_planars, l_planes, l_ground_plane);
-      }
-      else
-      {
-        lid_mapper_->localMap(input_data_.scan_pts_, header_.stamp.sec, l_corners, l_planars, l_ground_plane);
-      }
-#endif
+      lidarLocalMap(l_corners, l_planars, l_planes, l_ground_plane);
     }
 
     // Prepare and call the matcher
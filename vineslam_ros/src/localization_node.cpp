@@ -22,6 +22,8 @@ LocalizationNode::LocalizationNode() : VineSLAM_ros("LocalizationNode")
 {
   // Load params
   loadParameters(params_);
+  splitThreadPools();
+  Rng::setGlobalSeed(params_.random_seed_);
 
   // Set initialization flags default values
   init_flag_ = true;
@@ -33,17 +35,43 @@ LocalizationNode::LocalizationNode() : VineSLAM_ros("LocalizationNode")
 
   // Declare the Mappers and Localizer objects
   localizer_ = new Localizer(params_);
-#if LIDAR_SENSOR == 0
-  lid_mapper_ = new VelodyneMapper(params_);
-#elif LIDAR_SENSOR == 1
-  lid_mapper_ = new LivoxMapper(params_);
-#endif
   timer_ = new Timer("VineSLAM subfunctions");
 
-  // Scan subscription
-  scan_subscriber_ = this->create_subscription<sensor_msgs::msg::PointCloud2>(
-      "/scan_topic", 10,
-      std::bind(&VineSLAM_ros::scanListener, dynamic_cast<VineSLAM_ros*>(this), std::placeholders::_1));
+  // ---------------------------------------------------------
+  // ----- Load map dimensions and initialize it
+  // ---------------------------------------------------------
+  ElevationMapParser elevation_map_parser(params_);
+  MapParser map_parser(params_);
+  if (!map_parser.parseHeader(&params_))
+  {
+    RCLCPP_ERROR(this->get_logger(), "Map input file not found.");
+    return;
+  }
+  else
+  {
+    grid_map_ = new OccupancyMap(params_, Pose(0, 0, 0, 0, 0, 0), 1, 1);
+    elevation_map_ = new ElevationMap(params_, Pose(0, 0, 0, 0, 0, 0));
+  }
+
+  // ---------------------------------------------------------
+  // ----- Load the map from the xml input file
+  // ---------------------------------------------------------
+  if (!map_parser.parseFile(&(*grid_map_)))
+  {
+    RCLCPP_ERROR(this->get_logger(), "Map input file not found.");
+    return;
+  }
+  if (!elevation_map_parser.parseFile(&(*elevation_map_)))
+  {
+    RCLCPP_ERROR(this->get_logger(), "Map input file not found.");
+    return;
+  }
+
+  // Fork the scoring workers now, before the subscriptions, the transform listener, the LiDAR mappers and the
+  // execution thread are started - the filter is spread again once the robot pose on the map is set
+  localizer_->init(Pose(0, 0, 0, 0, 0, 0));
+  localizer_->spawnWorkers(grid_map_);
+
   // Odometry subscription
   odom_subscriber_ = this->create_subscription<nav_msgs::msg::Odometry>(
       "/odom_topic", 10,
@@ -90,8 +118,8 @@ LocalizationNode::LocalizationNode() : VineSLAM_ros("LocalizationNode")
   RCLCPP_INFO(this->get_logger(), "Waiting for static transforms...");
   tf2_ros::Buffer tf_buffer(this->get_clock());
   tf2_ros::TransformListener tfListener(tf_buffer);
-  geometry_msgs::msg::TransformStamped cam2base_msg, laser2base_msg;
-  bool got_cam2base = false, got_laser2base = false;
+  geometry_msgs::msg::TransformStamped cam2base_msg;
+  bool got_cam2base = false;
   while (!got_cam2base && rclcpp::ok())
   {
     try
@@ -106,20 +134,8 @@ LocalizationNode::LocalizationNode() : VineSLAM_ros("LocalizationNode")
     }
     got_cam2base = true;
   }
-  while (!got_laser2base && rclcpp::ok())
-  {
-    try
-    {
-      laser2base_msg = tf_buffer.lookupTransform(params_.lidar_sensor_frame_, "base_link", rclcpp::Time(0));
-    }
-    catch (tf2::TransformException& ex)
-    {
-      RCLCPP_WARN(this->get_logger(), "%s", ex.what());
-      rclcpp::sleep_for(std::chrono::nanoseconds(1000000000));
-      continue;
-    }
-    got_laser2base = true;
-  }
+  // LiDAR mappers, scan subscriptions and transforms
+  initLidars(tf_buffer);
   RCLCPP_INFO(this->get_logger(), "Received!");
 
   // Save tfs
@@ -132,48 +148,9 @@ LocalizationNode::LocalizationNode() : VineSLAM_ros("LocalizationNode")
   cam2base.getBasis().getRPY(roll, pitch, yaw);
   cam2base_tf_ = Pose(t.getX(), t.getY(), t.getZ(), roll, pitch, yaw).toTf();
 
-  tf2::Stamped<tf2::Transform> laser2base_stamped;
-  tf2::fromMsg(laser2base_msg, laser2base_stamped);
-
-  tf2::Transform laser2base = laser2base_stamped;  //.inverse();
-  t = laser2base.getOrigin();
-  laser2base.getBasis().getRPY(roll, pitch, yaw);
-
-  lid_mapper_->setLaser2Base(t.getX(), t.getY(), t.getZ(), roll, pitch, yaw);
-
   // Initialize tf broadcaster
   tf_broadcaster_ = std::make_shared<tf2_ros::TransformBroadcaster>(this);
 
-  // ---------------------------------------------------------
-  // ----- Load map dimensions and initialize it
-  // ---------------------------------------------------------
-  ElevationMapParser elevation_map_parser(params_);
-  MapParser map_parser(params_);
-  if (!map_parser.parseHeader(&params_))
-  {
-    RCLCPP_ERROR(this->get_logger(), "Map input file not found.");
-    return;
-  }
-  else
-  {
-    grid_map_ = new OccupancyMap(params_, Pose(0, 0, 0, 0, 0, 0), 1, 1);
-    elevation_map_ = new ElevationMap(params_, Pose(0, 0, 0, 0, 0, 0));
-  }
-
-  // ---------------------------------------------------------
-  // ----- Load the map from the xml input file
-  // ---------------------------------------------------------
-  if (!map_parser.parseFile(&(*grid_map_)))
-  {
-    RCLCPP_ERROR(this->get_logger(), "Map input file not found.");
-    return;
-  }
-  if (!elevation_map_parser.parseFile(&(*elevation_map_)))
-  {
-    RCLCPP_ERROR(this->get_logger(), "Map input file not found.");
-    return;
-  }
-
   // Load topological map
   topological_map_ = new TopologicalMap();
   agrob_map_io::TopologicalMapIO file_io_handler(params_.topological_map_input_file_);
@@ -245,12 +222,99 @@ void LocalizationNode::loadParameters(Parameters& params)
   {
     RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
   }
+  param = prefix + ".lidar_sensor";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_sensor_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
   param = prefix + ".lidar_sensor_frame";
   this->declare_parameter(param);
   if (!this->get_parameter(param, params.lidar_sensor_frame_))
   {
     RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
   }
+  param = prefix + ".lidar_model";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_model_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".lidar_height";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_height_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".lidar_segmentation";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_segmentation_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".lidar_plane_extraction";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_plane_extraction_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".lidar_voxel_size";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_voxel_size_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".lidar_voxel_centroid";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_voxel_centroid_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".livox_fov_half_angle";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.livox_fov_half_angle_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".livox_fov_bin_res";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.livox_fov_bin_res_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  int n_extra_lidars = 0;
+  param = prefix + ".extra_lidars.number";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, n_extra_lidars))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  for (int i = 1; i <= n_extra_lidars; i++)
+  {
+    std::string lidar_prefix = prefix + ".extra_lidars.lidar_" + std::to_string(i);
+    std::string sensor = "velodyne", sensor_frame, model = "vlp16";
+    param = lidar_prefix + ".sensor";
+    this->declare_parameter(param);
+    if (!this->get_parameter(param, sensor))
+    {
+      RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+    }
+    param = lidar_prefix + ".sensor_frame";
+    this->declare_parameter(param);
+    if (!this->get_parameter(param, sensor_frame))
+    {
+      RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+    }
+    param = lidar_prefix + ".model";
+    this->declare_parameter(param);
+    if (!this->get_parameter(param, model))
+    {
+      RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+    }
+    params.extra_lidar_sensors_.push_back(sensor);
+    params.extra_lidar_frames_.push_back(sensor_frame);
+    params.extra_lidar_models_.push_back(model);
+  }
   param = prefix + ".world_frame_id";
   this->declare_parameter(param);
   if (!this->get_parameter(param, params.world_frame_id_))
@@ -401,6 +465,30 @@ void LocalizationNode::loadParameters(Parameters& params)
   {
     RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
   }
+  param = prefix + ".multithreading.num_threads";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.num_threads_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".multithreading.reserved_cores";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.reserved_cores_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".multithreading.pin_threads";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.pin_threads_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".multithreading.pipelined_front_end";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.pipelined_front_end_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
   param = prefix + ".pf.n_particles";
   this->declare_parameter(param);
   if (!this->get_parameter(param, params.number_particles_))
@@ -443,6 +531,60 @@ void LocalizationNode::loadParameters(Parameters& params)
   {
     RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
   }
+  param = prefix + ".pf.random_seed";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.random_seed_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.parallel_resampling";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.parallel_resampling_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.time_budget";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.time_budget_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.fine_particles";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.fine_particles_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.coarse_subsampling";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.coarse_subsampling_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.reduced_state";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.reduced_state_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.async_updates";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.async_updates_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.async_resampling_neff";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.async_resampling_neff_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.worker_processes";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.worker_processes_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
 }
 
 void LocalizationNode::loop()
@@ -468,6 +610,20 @@ void LocalizationNode::loop()
 
 void LocalizationNode::loopOnce()
 {
+  // In the pipelined mode, once the system is initialized, the scans are taken by the front end thread, and this
+  // loop processes the frames it builds
+  if (params_.pipelined_front_end_ && !init_flag_)
+  {
+    if (nextFrame(params_.use_gps_))
+    {
+      Timer l_timer("VineSLAM main loop");
+      l_timer.tick("vineslam_ros::process()");
+      process();
+      l_timer.tock();
+    }
+    return;
+  }
+
   // Check if we have all the necessary data
   bool can_continue = input_data_.received_scans_ &&
                       // (input_data_.received_landmarks_ || !params_.use_semantic_features_) &&
@@ -481,6 +637,7 @@ void LocalizationNode::loopOnce()
   {
     Timer l_timer("VineSLAM main loop");
     l_timer.tick("vineslam_ros::process()");
+    buildFrame(scan_frame_, *timer_);
     process();
     l_timer.tock();
     //    l_timer.getLog();
@@ -503,6 +660,7 @@ void LocalizationNode::init()
   // ----- Initialize the localizer and get first particles distribution
   // ---------------------------------------------------------
   localizer_->init(robot_pose_);
+  localizer_->setElevationMap(elevation_map_);
   robot_pose_ = localizer_->getPose();
 
   // ---------------------------------------------------------
@@ -516,25 +674,7 @@ void LocalizationNode::init()
   SemiPlane l_ground_plane;
   if (params_.use_lidar_features_)
   {
-#if LIDAR_SENSOR == 0
-    if (params_.use_vertical_planes_)
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, l_corners, l_planars, l_planes, l_ground_plane);
-    }
-    else
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, l_corners, l_planars, l_ground_plane);
-    }
-#elif LIDAR_SENSOR == 1
-    if (params_.use_vertical_planes_)
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, header_.stamp.sec, l_corners, l_planars, l_planes, l_ground_plane);
-    }
-    else
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, header_.stamp.sec, l_corners, l_planars, l_ground_plane);
-    }
-#endif
+    lidarLocalMap(l_corners, l_planars, l_planes, l_ground_plane);
   }
 
   RCLCPP_INFO(this->get_logger(), "Localization has started.");
@@ -595,39 +735,12 @@ void LocalizationNode::process()
   // -------------------------------------------------------------------------------
   // -------------------------------------------------------------------------------
 
-  // ---------------------------------------------------------
-  // ----- Build local maps to use in the localization
-  // ---------------------------------------------------------
-
-  // - Compute 3D PCL corners and ground plane on robot's referential frame
-  std::vector<Corner> l_corners;
-  std::vector<Planar> l_planars;
-  std::vector<SemiPlane> l_planes;
-  SemiPlane l_ground_plane;
-  if (params_.use_lidar_features_)
-  {
-    timer_->tick("lidar_mapper::localMap()");
-#if LIDAR_SENSOR == 0
-    if (params_.use_vertical_planes_)
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, l_corners, l_planars, l_planes, l_ground_plane);
-    }
-    else
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, l_corners, l_planars, l_ground_plane);
-    }
-#elif LIDAR_SENSOR == 1
-    if (params_.use_vertical_planes_)
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, header_.stamp.sec, l_corners, l_planars, l_planes, l_ground_plane);
-    }
-    else
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, header_.stamp.sec, l_corners, l_planars, l_ground_plane);
-    }
-#endif
-    timer_->tock();
-  }
+  // - Local maps of the scan, and the inputs taken with it
+  ScanFrame& frame = scan_frame_;
+  std::vector<Corner>& l_corners = frame.corners_;
+  std::vector<Planar>& l_planars = frame.planars_;
+  std::vector<SemiPlane>& l_planes = frame.planes_;
+  SemiPlane& l_ground_plane = frame.ground_plane_;
 
   // ---------------------------------------------------------
   // ----- Build observation structure to use in the localization
@@ -639,24 +752,24 @@ void LocalizationNode::process()
   obsv_.planars_ = l_planars;
   obsv_.ground_plane_ = l_ground_plane;
   obsv_.planes_ = l_planes;
-  obsv_.gps_pose_ = input_data_.gnss_pose_;
-  obsv_.imu_pose_ = input_data_.imu_pose_;
+  obsv_.gps_pose_ = frame.gnss_pose_;
+  obsv_.imu_pose_ = frame.imu_pose_;
 
   // ---------------------------------------------------------
   // ----- Localization procedure
   // ---------------------------------------------------------
   Tf p_odom_tf = input_data_.p_wheel_odom_pose_.toTf();
-  Tf c_odom_tf = input_data_.wheel_odom_pose_.toTf();
+  Tf c_odom_tf = frame.wheel_odom_pose_.toTf();
   Tf odom_inc_tf = p_odom_tf.inverse() * c_odom_tf;
   Pose odom_inc(odom_inc_tf.R_array_, odom_inc_tf.t_array_);
-  input_data_.p_wheel_odom_pose_ = input_data_.wheel_odom_pose_;
+  input_data_.p_wheel_odom_pose_ = frame.wheel_odom_pose_;
   odom_inc.normalize();
 
   // Fuse odometry and gyroscope to get the innovation pose
   Pose innovation;
   if (params_.use_gyroscope_)
   {
-    computeInnovation(odom_inc, input_data_.imu_data_pose_, innovation);
+    computeInnovation(odom_inc, frame.imu_data_pose_, innovation);
   }
   else
   {
@@ -664,15 +777,10 @@ void LocalizationNode::process()
   }
 
   timer_->tick("localizer::process()");
-  localizer_->process(innovation, obsv_, grid_map_);
+  localizer_->process(innovation, obsv_, grid_map_, params_.time_budget_);
   robot_pose_ = localizer_->getPose();
   timer_->tock();
 
-  // ---------------------------------------------------------
-  // ----- Reset IMU gyroscope angular integrators
-  // ---------------------------------------------------------
-  input_data_.imu_data_pose_ = Pose(0, 0, 0, 0, 0, 0);
-
   // ---------------------------------------------------------
   // ----- Conversion of pose into latitude and longitude
   // ---------------------------------------------------------
@@ -812,25 +920,7 @@ void LocalizationNode::iMenuCallback(const visualization_msgs::msg::InteractiveM
     SemiPlane l_ground_plane;
     if (params_.use_lidar_features_)
     {
-#if LIDAR_SENSOR == 0
-      if (params_.use_vertical_planes_)
-      {
-        lid_mapper_->localMap(input_data_.scan_pts_, l_corners, l_planars, l_planes, l_ground_plane);
-      }
-      else
-      {
-        lid_mapper_->localMap(input_data_.scan_pts_, l_corners, l_planars, l_ground_plane);
-      }
-#elif LIDAR_SENSOR == 1
-      if (params_.use_vertical_planes_)
-      {
-        lid_mapper_->localMap(input_data_.scan_pts_, header_.stamp.sec, l_corners, l_planars, l_planes, l_ground_plane);
-      }
-      else
-      {
-        lid_mapper_->localMap(input_data_.scan_pts_, header_.stamp.sec, l_corners, l_planars, l_ground_plane);
-      }
-#endif
+      lidarLocalMap(l_corners, l_planars, l_planes, l_ground_plane);
     }
 
     // Prepare and call the matcher
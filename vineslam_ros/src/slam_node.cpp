@@ -20,6 +20,8 @@ SLAMNode::SLAMNode() : VineSLAM_ros("SLAMNode")
 {
   // Load params
   loadParameters(params_);
+  splitThreadPools();
+  Rng::setGlobalSeed(params_.random_seed_);
 
   // Set initialization flags default values
   init_flag_ = true;
@@ -32,11 +34,6 @@ SLAMNode::SLAMNode() : VineSLAM_ros("SLAMNode")
   // Declare the Mappers and Localizer objects
   localizer_ = new Localizer(params_);
   land_mapper_ = new LandmarkMapper(params_);
-#if LIDAR_SENSOR == 0
-  lid_mapper_ = new VelodyneMapper(params_);
-#elif LIDAR_SENSOR == 1
-  lid_mapper_ = new LivoxMapper(params_);
-#endif
   timer_ = new Timer("VineSLAM subfunctions");
 
   // Occupancy grid map subscriber
@@ -47,10 +44,6 @@ SLAMNode::SLAMNode() : VineSLAM_ros("SLAMNode")
   landmark_subscriber_ = this->create_subscription<vision_msgs::msg::Detection2DArray>(
       "/detections_topic", 10,
       std::bind(&VineSLAM_ros::landmarkListener, dynamic_cast<VineSLAM_ros*>(this), std::placeholders::_1));
-  // Scan subscription
-  scan_subscriber_ = this->create_subscription<sensor_msgs::msg::PointCloud2>(
-      "/scan_topic", 10,
-      std::bind(&VineSLAM_ros::scanListener, dynamic_cast<VineSLAM_ros*>(this), std::placeholders::_1));
   // Odometry subscription
   odom_subscriber_ = this->create_subscription<nav_msgs::msg::Odometry>(
       "/odom_topic", 10,
@@ -102,8 +95,8 @@ SLAMNode::SLAMNode() : VineSLAM_ros("SLAMNode")
   RCLCPP_INFO(this->get_logger(), "Waiting for static transforms...");
   tf2_ros::Buffer tf_buffer(this->get_clock());
   tf2_ros::TransformListener tfListener(tf_buffer);
-  geometry_msgs::msg::TransformStamped cam2base_msg, laser2base_msg;
-  bool got_cam2base = false, got_laser2base = false;
+  geometry_msgs::msg::TransformStamped cam2base_msg;
+  bool got_cam2base = false;
   while (!got_cam2base && rclcpp::ok())
   {
     try
@@ -118,20 +111,8 @@ SLAMNode::SLAMNode() : VineSLAM_ros("SLAMNode")
     }
     got_cam2base = true;
   }
-  while (!got_laser2base && rclcpp::ok())
-  {
-    try
-    {
-      laser2base_msg = tf_buffer.lookupTransform(params_.lidar_sensor_frame_, "base_link", rclcpp::Time(0));
-    }
-    catch (tf2::TransformException& ex)
-    {
-      RCLCPP_WARN(this->get_logger(), "%s", ex.what());
-      rclcpp::sleep_for(std::chrono::nanoseconds(1000000000));
-      continue;
-    }
-    got_laser2base = true;
-  }
+  // LiDAR mappers, scan subscriptions and transforms
+  initLidars(tf_buffer);
   RCLCPP_INFO(this->get_logger(), "Received!");
 
   // Save sensors to map transformation
@@ -144,15 +125,6 @@ SLAMNode::SLAMNode() : VineSLAM_ros("SLAMNode")
   cam2base.getBasis().getRPY(roll, pitch, yaw);
   cam2base_tf_ = Pose(t.getX(), t.getY(), t.getZ(), roll, pitch, yaw).toTf();
 
-  tf2::Stamped<tf2::Transform> laser2base_stamped;
-  tf2::fromMsg(laser2base_msg, laser2base_stamped);
-
-  tf2::Transform laser2base = laser2base_stamped;  //.inverse();
-  t = laser2base.getOrigin();
-  laser2base.getBasis().getRPY(roll, pitch, yaw);
-
-  lid_mapper_->setLaser2Base(t.getX(), t.getY(), t.getZ(), roll, pitch, yaw);
-
   // Initialize tf broadcaster
   tf_broadcaster_ = std::make_shared<tf2_ros::TransformBroadcaster>(this);
 
@@ -231,12 +203,99 @@ void SLAMNode::loadParameters(Parameters& params)
   {
     RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
   }
+  param = prefix + ".lidar_sensor";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_sensor_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
   param = prefix + ".lidar_sensor_frame";
   this->declare_parameter(param);
   if (!this->get_parameter(param, params.lidar_sensor_frame_))
   {
     RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
   }
+  param = prefix + ".lidar_model";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_model_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".lidar_height";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_height_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".lidar_segmentation";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_segmentation_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".lidar_plane_extraction";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_plane_extraction_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".lidar_voxel_size";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_voxel_size_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".lidar_voxel_centroid";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.lidar_voxel_centroid_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".livox_fov_half_angle";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.livox_fov_half_angle_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".livox_fov_bin_res";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.livox_fov_bin_res_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  int n_extra_lidars = 0;
+  param = prefix + ".extra_lidars.number";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, n_extra_lidars))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  for (int i = 1; i <= n_extra_lidars; i++)
+  {
+    std::string lidar_prefix = prefix + ".extra_lidars.lidar_" + std::to_string(i);
+    std::string sensor = "velodyne", sensor_frame, model = "vlp16";
+    param = lidar_prefix + ".sensor";
+    this->declare_parameter(param);
+    if (!this->get_parameter(param, sensor))
+    {
+      RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+    }
+    param = lidar_prefix + ".sensor_frame";
+    this->declare_parameter(param);
+    if (!this->get_parameter(param, sensor_frame))
+    {
+      RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+    }
+    param = lidar_prefix + ".model";
+    this->declare_parameter(param);
+    if (!this->get_parameter(param, model))
+    {
+      RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+    }
+    params.extra_lidar_sensors_.push_back(sensor);
+    params.extra_lidar_frames_.push_back(sensor_frame);
+    params.extra_lidar_models_.push_back(model);
+  }
   param = prefix + ".world_frame_id";
   this->declare_parameter(param);
   if (!this->get_parameter(param, params.world_frame_id_))
@@ -447,6 +506,30 @@ void SLAMNode::loadParameters(Parameters& params)
   {
     RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
   }
+  param = prefix + ".multithreading.num_threads";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.num_threads_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".multithreading.reserved_cores";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.reserved_cores_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".multithreading.pin_threads";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.pin_threads_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".multithreading.pipelined_front_end";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.pipelined_front_end_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
   param = prefix + ".pf.n_particles";
   this->declare_parameter(param);
   if (!this->get_parameter(param, params.number_particles_))
@@ -489,6 +572,54 @@ void SLAMNode::loadParameters(Parameters& params)
   {
     RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
   }
+  param = prefix + ".pf.random_seed";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.random_seed_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.parallel_resampling";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.parallel_resampling_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.time_budget";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.time_budget_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.fine_particles";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.fine_particles_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.coarse_subsampling";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.coarse_subsampling_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.reduced_state";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.reduced_state_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.async_updates";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.async_updates_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
+  param = prefix + ".pf.async_resampling_neff";
+  this->declare_parameter(param);
+  if (!this->get_parameter(param, params.async_resampling_neff_))
+  {
+    RCLCPP_WARN(this->get_logger(), "%s not found.", param.c_str());
+  }
 }
 
 void SLAMNode::loop()
@@ -507,6 +638,25 @@ void SLAMNode::loop()
 
 void SLAMNode::loopOnce()
 {
+  // In the pipelined mode, once the system is initialized, the scans are taken by the front end thread, and this
+  // loop processes the frames it builds
+  if (params_.pipelined_front_end_ && !init_flag_)
+  {
+    if (nextFrame(false))
+    {
+      Timer l_timer("VineSLAM main loop");
+      l_timer.tick("vineslam_ros::process()");
+      process();
+      l_timer.tock();
+      l_timer.getLog();
+      l_timer.clearLog();
+
+      timer_->getLog();
+      timer_->clearLog();
+    }
+    return;
+  }
+
   // Check if we have all the necessary data
   bool can_continue = input_data_.received_scans_;
   //                    (input_data_.received_landmarks_ || !params_.use_semantic_features_);  // &&
@@ -527,6 +677,7 @@ void SLAMNode::loopOnce()
   {
     Timer l_timer("VineSLAM main loop");
     l_timer.tick("vineslam_ros::process()");
+    buildFrame(scan_frame_, *timer_);
     process();
     l_timer.tock();
     l_timer.getLog();
@@ -549,6 +700,7 @@ void SLAMNode::init()
   // ----- Initialize the localizer and get first particles distribution
   // ---------------------------------------------------------
   localizer_->init(Pose(0, 0, 0, 0, 0, 0));
+  localizer_->setElevationMap(elevation_map_);
   localizer_->changeGPSFlag(false);  // We do not trust the GPS at the beginning since we still have to estimate
                                      // heading
   robot_pose_ = localizer_->getPose();
@@ -571,29 +723,15 @@ void SLAMNode::init()
   SemiPlane l_ground_plane;
   if (params_.use_lidar_features_)
   {
-#if LIDAR_SENSOR == 0
-    if (params_.use_vertical_planes_)
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, l_corners, l_planars, l_planes, l_ground_plane);
-    }
-    else
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, l_corners, l_planars, l_ground_plane);
-    }
-#elif LIDAR_SENSOR == 1
-    if (params_.use_vertical_planes_)
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, header_.stamp.sec, l_corners, l_planars, l_planes, l_ground_plane);
-    }
-    else
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, header_.stamp.sec, l_corners, l_planars, l_ground_plane);
-    }
-#endif
+    lidarLocalMap(l_corners, l_planars, l_planes, l_ground_plane);
   }
 
   // - Register 3D maps
   lid_mapper_->registerMaps(robot_pose_, l_corners, l_planars, l_planes, l_ground_plane, *grid_map_, *elevation_map_);
+  for (size_t i = 1; i < lid_mappers_.size(); i++)
+  {
+    lid_mappers_[i]->setPrevRobotPose(robot_pose_);
+  }
   grid_map_->downsamplePlanars();
 
   // Create logs file if desired
@@ -614,39 +752,12 @@ void SLAMNode::process()
   // -------------------------------------------------------------------------------
   // -------------------------------------------------------------------------------
 
-  // ---------------------------------------------------------
-  // ----- Build local maps to use in the localization
-  // ---------------------------------------------------------
-
-  // - Compute 3D PCL corners and ground plane on robot's referential frame
-  std::vector<Corner> l_corners;
-  std::vector<Planar> l_planars;
-  std::vector<SemiPlane> l_planes;
-  SemiPlane l_ground_plane;
-  if (params_.use_lidar_features_)
-  {
-    timer_->tick("lidar_mapper::localMap()");
-#if LIDAR_SENSOR == 0
-    if (params_.use_vertical_planes_)
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, l_corners, l_planars, l_planes, l_ground_plane);
-    }
-    else
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, l_corners, l_planars, l_ground_plane);
-    }
-#elif LIDAR_SENSOR == 1
-    if (params_.use_vertical_planes_)
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, header_.stamp.sec, l_corners, l_planars, l_planes, l_ground_plane);
-    }
-    else
-    {
-      lid_mapper_->localMap(input_data_.scan_pts_, header_.stamp.sec, l_corners, l_planars, l_ground_plane);
-    }
-#endif
-    timer_->tock();
-  }
+  // - Local maps of the scan, and the inputs taken with it
+  ScanFrame& frame = scan_frame_;
+  std::vector<Corner>& l_corners = frame.corners_;
+  std::vector<Planar>& l_planars = frame.planars_;
+  std::vector<SemiPlane>& l_planes = frame.planes_;
+  SemiPlane& l_ground_plane = frame.ground_plane_;
 
   // ---------------------------------------------------------
   // ----- Build observation structure to use in the localization
@@ -658,25 +769,25 @@ void SLAMNode::process()
   obsv_.planars_ = l_planars;
   obsv_.ground_plane_ = l_ground_plane;
   obsv_.planes_ = l_planes;
-  obsv_.gps_pose_ = input_data_.gnss_pose_;
-  obsv_.imu_pose_ = input_data_.imu_pose_;
+  obsv_.gps_pose_ = frame.gnss_pose_;
+  obsv_.imu_pose_ = frame.imu_pose_;
 
   // ---------------------------------------------------------
   // ----- Localization procedure
   // ---------------------------------------------------------
   Tf p_odom_tf = input_data_.p_wheel_odom_pose_.toTf();
-  Tf c_odom_tf = input_data_.wheel_odom_pose_.toTf();
+  Tf c_odom_tf = frame.wheel_odom_pose_.toTf();
   Tf odom_inc_tf = p_odom_tf.inverse() * c_odom_tf;
   Pose odom_inc(odom_inc_tf.R_array_, odom_inc_tf.t_array_);
   //  odom_inc.x_ = -odom_inc.x_;
-  input_data_.p_wheel_odom_pose_ = input_data_.wheel_odom_pose_;
+  input_data_.p_wheel_odom_pose_ = frame.wheel_odom_pose_;
   odom_inc.normalize();
 
   // Fuse odometry and gyroscope to get the innovation pose
   Pose innovation;
   if (params_.use_gyroscope_)
   {
-    computeInnovation(odom_inc, input_data_.imu_data_pose_, innovation);
+    computeInnovation(odom_inc, frame.imu_data_pose_, innovation);
   }
   else
   {
@@ -684,15 +795,10 @@ void SLAMNode::process()
   }
 
   timer_->tick("localizer::process()");
-  localizer_->process(innovation, obsv_, grid_map_);
+  localizer_->process(innovation, obsv_, grid_map_, params_.time_budget_);
   robot_pose_ = localizer_->getPose();
   timer_->tock();
 
-  // ---------------------------------------------------------
-  // ----- Reset IMU gyroscope angular integrators
-  // ---------------------------------------------------------
-  input_data_.imu_data_pose_ = Pose(0, 0, 0, 0, 0, 0);
-
   // ---------------------------------------------------------
   // ----- Register multi-layer map
   // ---------------------------------------------------------
@@ -704,13 +810,13 @@ void SLAMNode::process()
   if (params_.use_semantic_features_)
   {
     timer_->tick("landmark_mapper::localMap()");
-    land_mapper_->localMap(cam_origin_pose, input_data_.land_labels_, input_data_.land_bearings_,
-                           input_data_.land_pitches_, l_landmarks, *grid_map_, robot_pose_);
+    land_mapper_->localMap(cam_origin_pose, frame.land_labels_, frame.land_bearings_, frame.land_pitches_, l_landmarks,
+                           *grid_map_, robot_pose_);
     // land_mapper_->localMap(cam_origin_pose, input_data_.land_labels_, input_data_.land_bearings_,
     //                        input_data_.land_pitches_, l_landmarks, grid_map_->planes_, robot_pose_);
     timer_->tock();
     timer_->tick("landmark_mapper::process()");
-    land_mapper_->process(robot_pose_, l_landmarks, input_data_.land_labels_, *grid_map_);
+    land_mapper_->process(robot_pose_, l_landmarks, frame.land_labels_, *grid_map_);
     std::cout << "# landmarks mapped: " << grid_map_->getLandmarks().size() << "\n";
     timer_->tock();
   }
@@ -719,6 +825,10 @@ void SLAMNode::process()
   {
     timer_->tick("lidar_mapper::registerMaps()");
     lid_mapper_->registerMaps(robot_pose_, l_corners, l_planars, l_planes, l_ground_plane, *grid_map_, *elevation_map_);
+    for (size_t i = 1; i < lid_mappers_.size(); i++)
+    {
+      lid_mappers_[i]->setPrevRobotPose(robot_pose_);
+    }
     timer_->tock();
 
     timer_->tick("grid_map::downsamplePlanars()");
@@ -748,7 +858,7 @@ void SLAMNode::process()
 
   // Convert vineslam pose to ROS pose and publish it
   geometry_msgs::msg::PoseStamped pose_stamped;
-  pose_stamped.header.stamp = header_.stamp;
+  pose_stamped.header.stamp = frame.header_.stamp;
   pose_stamped.header.frame_id = params_.world_frame_id_;
   pose_stamped.pose.position.x = robot_pose_.x_;
   pose_stamped.pose.position.y = robot_pose_.y_;
@@ -769,7 +879,7 @@ void SLAMNode::process()
 
   // Publish robot pose in GNSS polar coordinates
   sensor_msgs::msg::NavSatFix pose_ll;
-  pose_ll.header.stamp = header_.stamp;
+  pose_ll.header.stamp = frame.header_.stamp;
   pose_ll.header.frame_id = "gps";
   pose_ll.latitude = robot_latitude;
   pose_ll.longitude = robot_longitude;
@@ -794,7 +904,7 @@ void SLAMNode::process()
 
     // Save the pcl file
     pcl::PointCloud<pcl::PointXYZI> cloud;
-    for (const auto& pt : input_data_.scan_pts_)
+    for (const auto& pt : frame.scan_pts_)
     {
       pcl::PointXYZI pcl_pt;
       pcl_pt.x = pt.x_;
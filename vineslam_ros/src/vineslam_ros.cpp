@@ -98,22 +98,119 @@ void VineSLAM_ros::landmarkListener(const vision_msgs::msg::Detection2DArray::Sh
   input_data_.received_landmarks_ = true;
 }
 
-void VineSLAM_ros::scanListener(const sensor_msgs::msg::PointCloud2::SharedPtr msg)
+VineSLAM_ros::~VineSLAM_ros()
 {
-  pcl::PointCloud<pcl::PointXYZI>::Ptr velodyne_pcl(new pcl::PointCloud<pcl::PointXYZI>);
-  pcl::fromROSMsg(*msg, *velodyne_pcl);
-  // Remove Nan points
-  std::vector<int> indices;
-  pcl::removeNaNFromPointCloud(*velodyne_pcl, *velodyne_pcl, indices);
+  for (auto& worker : lidar_workers_)
+  {
+    {
+      std::lock_guard<std::mutex> lock(worker->mutex_);
+      worker->stop_ = true;
+    }
+    worker->cv_.notify_all();
+    worker->thread_.join();
+  }
+}
+
+void VineSLAM_ros::scanListener(const sensor_msgs::msg::PointCloud2::SharedPtr msg, const size_t& lidar_idx)
+{
+  // The message is parsed outside of the lock, into the buffer of this listener
+  ScanSlot& slot = *scan_slots_[lidar_idx];
+  LidarScan& scan = slot.parsed_;
+  scan.time_stamp_ = static_cast<double>(msg->header.stamp.sec) + static_cast<double>(msg->header.stamp.nanosec) * 1e-9;
+  scan.rings_.clear();
+  scan.columns_.clear();
+  scan.n_columns_ = 0;
+
+  // Organized scans - keep the ring of each point, and its column if the cloud is a range image
+  int x_offset = -1, y_offset = -1, z_offset = -1, intensity_offset = -1, ring_offset = -1;
+  uint8_t ring_type = 0;
+  for (const auto& field : msg->fields)
+  {
+    if (field.name == "x")
+      x_offset = static_cast<int>(field.offset);
+    else if (field.name == "y")
+      y_offset = static_cast<int>(field.offset);
+    else if (field.name == "z")
+      z_offset = static_cast<int>(field.offset);
+    else if (field.name == "intensity")
+      intensity_offset = static_cast<int>(field.offset);
+    else if (field.name == "ring")
+    {
+      ring_offset = static_cast<int>(field.offset);
+      ring_type = field.datatype;
+    }
+  }
+
+  if (x_offset >= 0 && y_offset >= 0 && z_offset >= 0 && ring_offset >= 0 &&
+      (ring_type == sensor_msgs::msg::PointField::UINT16 || ring_type == sensor_msgs::msg::PointField::UINT8))
+  {
+    size_t n_pts = msg->width * msg->height;
+    scan.pts_.clear();
+    scan.pts_.reserve(n_pts);
+    scan.rings_.reserve(n_pts);
+    if (msg->height > 1)
+    {
+      scan.columns_.reserve(n_pts);
+      scan.n_columns_ = msg->width;
+    }
+
+    for (size_t i = 0; i < n_pts; i++)
+    {
+      const uint8_t* data = &msg->data[(i / msg->width) * msg->row_step + (i % msg->width) * msg->point_step];
+
+      float x, y, z, intensity = 0.;
+      std::memcpy(&x, data + x_offset, sizeof(float));
+      std::memcpy(&y, data + y_offset, sizeof(float));
+      std::memcpy(&z, data + z_offset, sizeof(float));
+      if (!std::isfinite(x) || !std::isfinite(y) || !std::isfinite(z))
+      {
+        continue;
+      }
+      if (intensity_offset >= 0)
+      {
+        std::memcpy(&intensity, data + intensity_offset, sizeof(float));
+      }
+
+      uint16_t ring = data[ring_offset];
+      if (ring_type == sensor_msgs::msg::PointField::UINT16)
+      {
+        std::memcpy(&ring, data + ring_offset, sizeof(uint16_t));
+      }
 
-  input_data_.scan_pts_.clear();
-  for (const auto& pt : *velodyne_pcl)
+      scan.pts_.emplace_back(x, y, z, intensity);
+      scan.rings_.push_back(ring);
+      if (msg->height > 1)
+      {
+        scan.columns_.push_back(static_cast<uint16_t>(i % msg->width));
+      }
+    }
+  }
+  else
   {
-    Point l_pt(pt.x, pt.y, pt.z, pt.intensity);
-    input_data_.scan_pts_.push_back(l_pt);
+    pcl::PointCloud<pcl::PointXYZI>::Ptr velodyne_pcl(new pcl::PointCloud<pcl::PointXYZI>);
+    pcl::fromROSMsg(*msg, *velodyne_pcl);
+    // Remove Nan points
+    std::vector<int> indices;
+    pcl::removeNaNFromPointCloud(*velodyne_pcl, *velodyne_pcl, indices);
+
+    scan.pts_.clear();
+    for (const auto& pt : *velodyne_pcl)
+    {
+      Point l_pt(pt.x, pt.y, pt.z, pt.intensity);
+      scan.pts_.push_back(l_pt);
+    }
   }
 
-  input_data_.received_scans_ = true;
+  // Hand the scan over - only the scans of the main LiDAR trigger a new iteration
+  {
+    std::lock_guard<std::mutex> lock(slot.mutex_);
+    std::swap(slot.scan_, slot.parsed_);
+    slot.new_scan_ = true;
+  }
+  if (lidar_idx == 0)
+  {
+    input_data_.received_scans_ = true;
+  }
 }
 
 void VineSLAM_ros::odomListener(const nav_msgs::msg::Odometry::SharedPtr msg)
@@ -203,6 +300,12 @@ void VineSLAM_ros::gpsListener(const sensor_msgs::msg::NavSatFix::SharedPtr msg)
     // Set received flag to true
     input_data_.received_gnss_ = true;
 
+    // Apply the GPS layer at the sensor rate, independently of the LiDAR update
+    if (params_.async_updates_ && !init_flag_)
+    {
+      localizer_->processGPS(input_data_.gnss_pose_);
+    }
+
     // Publish gps pose
     geometry_msgs::msg::PoseStamped pose_stamped;
     pose_stamped.header.stamp = header_.stamp;
@@ -226,6 +329,12 @@ void VineSLAM_ros::imuListener(const geometry_msgs::msg::Vector3Stamped::SharedP
   input_data_.imu_pose_.R_ = msg->vector.x;
   input_data_.imu_pose_.P_ = msg->vector.y;
   input_data_.imu_pose_.Y_ = 0;
+
+  // Apply the IMU layer at the sensor rate, independently of the LiDAR update
+  if (params_.async_updates_ && !init_flag_)
+  {
+    localizer_->processIMU(input_data_.imu_pose_);
+  }
 }
 
 void VineSLAM_ros::imuDataListener(const sensor_msgs::msg::Imu::SharedPtr msg)
@@ -275,6 +384,322 @@ void VineSLAM_ros::computeInnovation(const Pose& wheel_odom_inc, const Pose& imu
   output_pose = Pose(wheel_odom_inc.x_, wheel_odom_inc.y_, 0, imu_rot_inc.R_, imu_rot_inc.P_, hat_yaw);
 }
 
+void VineSLAM_ros::buildFrame(ScanFrame& frame, Timer& timer)
+{
+  frame.header_ = header_;
+
+  // ---------------------------------------------------------
+  // ----- Build local maps to use in the localization
+  // ---------------------------------------------------------
+
+  // - Compute 3D PCL corners and ground plane on robot's referential frame
+  frame.corners_.clear();
+  frame.planars_.clear();
+  frame.planes_.clear();
+  frame.ground_plane_ = SemiPlane();
+  if (params_.use_lidar_features_)
+  {
+    timer.tick("lidar_mapper::localMap()");
+    lidarLocalMap(frame.corners_, frame.planars_, frame.planes_, frame.ground_plane_);
+    timer.tock();
+  }
+
+  // ---------------------------------------------------------
+  // ----- Take the other inputs
+  // ---------------------------------------------------------
+  frame.wheel_odom_pose_ = input_data_.wheel_odom_pose_;
+  frame.gnss_pose_ = input_data_.gnss_pose_;
+  frame.imu_pose_ = input_data_.imu_pose_;
+  frame.imu_data_pose_ = input_data_.imu_data_pose_;
+  input_data_.imu_data_pose_ = Pose(0, 0, 0, 0, 0, 0);
+  if (params_.use_semantic_features_)
+  {
+    frame.land_labels_ = input_data_.land_labels_;
+    frame.land_bearings_ = input_data_.land_bearings_;
+    frame.land_pitches_ = input_data_.land_pitches_;
+  }
+  if (params_.save_logs_)
+  {
+    frame.scan_pts_ = main_scan_.pts_;
+  }
+}
+
+void VineSLAM_ros::splitThreadPools()
+{
+  params_.thread_pools_ = 1;
+  params_.thread_pool_idx_ = 0;
+
+  // In the sequential mode with a single LiDAR the pools take turns, so each one takes all the worker threads
+  if (!params_.pipelined_front_end_ && params_.extra_lidar_sensors_.empty())
+  {
+    return;
+  }
+
+  if (params_.lidar_sensor_ != "livox")
+  {
+    params_.thread_pools_++;
+  }
+  for (const auto& sensor : params_.extra_lidar_sensors_)
+  {
+    if (sensor != "livox")
+    {
+      params_.thread_pools_++;
+    }
+  }
+}
+
+void VineSLAM_ros::initLidars(tf2_ros::Buffer& tf_buffer)
+{
+  // The main LiDAR comes first, followed by the additional ones
+  std::vector<std::string> sensors = { params_.lidar_sensor_ };
+  std::vector<std::string> frames = { params_.lidar_sensor_frame_ };
+  std::vector<std::string> models = { params_.lidar_model_ };
+  sensors.insert(sensors.end(), params_.extra_lidar_sensors_.begin(), params_.extra_lidar_sensors_.end());
+  frames.insert(frames.end(), params_.extra_lidar_frames_.begin(), params_.extra_lidar_frames_.end());
+  models.insert(models.end(), params_.extra_lidar_models_.begin(), params_.extra_lidar_models_.end());
+
+  for (size_t i = 0; i < sensors.size(); i++)
+  {
+    scan_slots_.emplace_back(new ScanSlot);
+  }
+
+  int pool_idx = 1;
+  for (size_t i = 0; i < sensors.size(); i++)
+  {
+    // Each mapper takes the model of its own sensor, and the Velodyne ones their own share of the worker threads
+    Parameters lidar_params = params_;
+    lidar_params.lidar_model_ = models[i];
+    lidar_params.thread_pool_idx_ = (params_.thread_pools_ > 1) ? pool_idx : 0;
+    if (sensors[i] != "livox")
+    {
+      pool_idx++;
+    }
+
+    LidarMapper* mapper = LidarMapper::create(sensors[i], lidar_params);
+    if (mapper == nullptr)
+    {
+      RCLCPP_WARN(this->get_logger(), "LiDAR sensor %s not supported, using velodyne.", sensors[i].c_str());
+      mapper = LidarMapper::create("velodyne", lidar_params);
+    }
+    lid_mappers_.push_back(mapper);
+
+    // Scan subscription
+    std::string topic = (i == 0) ? "/scan_topic" : "/scan_topic_" + std::to_string(i);
+    scan_subscribers_.push_back(this->create_subscription<sensor_msgs::msg::PointCloud2>(
+        topic, 10,
+        std::bind(&VineSLAM_ros::scanListener, dynamic_cast<VineSLAM_ros*>(this), std::placeholders::_1, i)));
+
+    // LiDAR to base_link transformation
+    geometry_msgs::msg::TransformStamped laser2base_msg;
+    bool got_laser2base = false;
+    while (!got_laser2base && rclcpp::ok())
+    {
+      try
+      {
+        laser2base_msg = tf_buffer.lookupTransform(frames[i], "base_link", rclcpp::Time(0));
+      }
+      catch (tf2::TransformException& ex)
+      {
+        RCLCPP_WARN(this->get_logger(), "%s", ex.what());
+        rclcpp::sleep_for(std::chrono::nanoseconds(1000000000));
+        continue;
+      }
+      got_laser2base = true;
+    }
+
+    tf2::Stamped<tf2::Transform> laser2base_stamped;
+    tf2::fromMsg(laser2base_msg, laser2base_stamped);
+
+    tf2::Transform laser2base = laser2base_stamped;  //.inverse();
+    tf2::Vector3 t = laser2base.getOrigin();
+    tf2Scalar roll, pitch, yaw;
+    laser2base.getBasis().getRPY(roll, pitch, yaw);
+
+    mapper->setLaser2Base(t.getX(), t.getY(), t.getZ(), roll, pitch, yaw);
+  }
+
+  lid_mapper_ = lid_mappers_[0];
+
+  // Long-lived workers of the additional LiDARs, so that their thread local workspaces persist between scans
+  for (size_t i = 1; i < sensors.size(); i++)
+  {
+    lidar_workers_.emplace_back(new LidarWorker);
+  }
+  for (size_t i = 1; i < sensors.size(); i++)
+  {
+    lidar_workers_[i - 1]->thread_ = std::thread(&VineSLAM_ros::lidarWorker, this, i);
+  }
+}
+
+void VineSLAM_ros::scanLocalMap(LidarMapper* mapper, const LidarScan& scan, std::vector<Corner>& out_corners,
+                                std::vector<Planar>& out_planars, std::vector<SemiPlane>& out_planes,
+                                SemiPlane& out_ground_plane)
+{
+  if (params_.use_vertical_planes_)
+  {
+    mapper->localMap(scan, out_corners, out_planars, out_planes, out_ground_plane);
+  }
+  else
+  {
+    mapper->localMap(scan, out_corners, out_planars, out_ground_plane);
+  }
+}
+
+bool VineSLAM_ros::takeScan(ScanSlot& slot, LidarScan& scan)
+{
+  std::lock_guard<std::mutex> lock(slot.mutex_);
+  if (!slot.new_scan_)
+  {
+    return false;
+  }
+
+  // Swap the buffers, so that the listener reuses the one of the previous scan
+  std::swap(slot.scan_, scan);
+  slot.new_scan_ = false;
+  return true;
+}
+
+void VineSLAM_ros::lidarLocalMap(std::vector<Corner>& out_corners, std::vector<Planar>& out_planars,
+                                 std::vector<SemiPlane>& out_planes, SemiPlane& out_ground_plane)
+{
+  // Take the latest scan of the main LiDAR - the current one is processed again if there is no new one
+  double time_stamp = main_scan_.time_stamp_;
+  if (takeScan(*scan_slots_[0], main_scan_))
+  {
+    prev_main_time_stamp_ = time_stamp;
+  }
+
+  // Request the local maps of the additional LiDARs from their workers, and build the one of the main LiDAR here
+  for (auto& worker : lidar_workers_)
+  {
+    {
+      std::lock_guard<std::mutex> lock(worker->mutex_);
+      worker->min_time_stamp_ = prev_main_time_stamp_;
+      worker->requested_ = true;
+      worker->done_ = false;
+    }
+    worker->cv_.notify_all();
+  }
+  scanLocalMap(lid_mappers_[0], main_scan_, out_corners, out_planars, out_planes, out_ground_plane);
+
+  // Merge the local maps, that are all on the base_link referential frame
+  for (auto& worker : lidar_workers_)
+  {
+    std::unique_lock<std::mutex> lock(worker->mutex_);
+    worker->cv_.wait(lock, [&worker] { return worker->done_ || worker->stop_; });
+    if (!worker->valid_)
+    {
+      continue;
+    }
+
+    const ScanFrame& frame = worker->frame_;
+    out_corners.insert(out_corners.end(), frame.corners_.begin(), frame.corners_.end());
+    out_planars.insert(out_planars.end(), frame.planars_.begin(), frame.planars_.end());
+    out_planes.insert(out_planes.end(), frame.planes_.begin(), frame.planes_.end());
+    if (frame.ground_plane_.points_.size() > out_ground_plane.points_.size())
+    {
+      out_ground_plane = frame.ground_plane_;
+    }
+  }
+}
+
+void VineSLAM_ros::lidarWorker(const size_t& lidar_idx)
+{
+  LidarWorker& worker = *lidar_workers_[lidar_idx - 1];
+
+  // Each additional LiDAR takes its own random stream, after the ones of the main thread and of the front end
+  Rng::setThreadStream(1 + lidar_idx);
+
+  std::unique_lock<std::mutex> lock(worker.mutex_);
+  while (true)
+  {
+    worker.cv_.wait(lock, [&worker] { return worker.requested_ || worker.stop_; });
+    if (worker.stop_)
+    {
+      return;
+    }
+    worker.requested_ = false;
+    double min_time_stamp = worker.min_time_stamp_;
+    lock.unlock();
+
+    // Only a scan that was not merged yet, and that is not older than the main one by more than a scan period, is
+    // taken - a stale or repeated scan would add features that do not match the robot pose
+    ScanFrame& frame = worker.frame_;
+    frame.corners_.clear();
+    frame.planars_.clear();
+    frame.planes_.clear();
+    frame.ground_plane_ = SemiPlane();
+    bool valid = takeScan(*scan_slots_[lidar_idx], worker.scan_) &&
+                 worker.scan_.time_stamp_ > worker.last_time_stamp_ && worker.scan_.time_stamp_ >= min_time_stamp;
+    if (valid)
+    {
+      scanLocalMap(lid_mappers_[lidar_idx], worker.scan_, frame.corners_, frame.planars_, frame.planes_,
+                   frame.ground_plane_);
+      worker.last_time_stamp_ = worker.scan_.time_stamp_;
+    }
+
+    lock.lock();
+    worker.valid_ = valid;
+    worker.done_ = true;
+    worker.cv_.notify_all();
+  }
+}
+
+void VineSLAM_ros::frontEnd(const bool& wait_for_gnss)
+{
+  Timer l_timer("VineSLAM front end");
+  ScanFrame frame;
+
+  // The front end builds the local maps of the main LiDAR - it takes the random stream 1, after the one of the main
+  // thread, so that its RANSAC fits are the same in every run
+  Rng::setThreadStream(1);
+
+  while (rclcpp::ok())
+  {
+    // Check if we have all the necessary data
+    bool can_continue = input_data_.received_scans_ && (input_data_.received_gnss_ || !wait_for_gnss);
+    if (!can_continue)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      continue;
+    }
+
+    // Reset information flags, so that the scans received from now on are taken in the next iteration
+    input_data_.received_scans_ = false;
+    input_data_.received_landmarks_ = false;
+    input_data_.received_odometry_ = false;
+    input_data_.received_gnss_ = false;
+
+    buildFrame(frame, l_timer);
+    l_timer.getLog();
+    l_timer.clearLog();
+
+    // Wait for the main loop to take the previous frame
+    while (!scan_frames_.push(frame) && rclcpp::ok())
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+}
+
+bool VineSLAM_ros::nextFrame(const bool& wait_for_gnss)
+{
+  if (!front_end_launched_)
+  {
+    std::thread th(&VineSLAM_ros::frontEnd, this, wait_for_gnss);
+    th.detach();
+    front_end_launched_ = true;
+  }
+
+  if (!scan_frames_.pop(scan_frame_))
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    return false;
+  }
+
+  return true;
+}
+
 void VineSLAM_ros::getGNSSHeading()
 {
   float robot_distance_traveleld = robot_pose_.norm3D();